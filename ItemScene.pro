@@ -26,17 +26,26 @@ SOURCES += \
     item_scene/pge_edit_scene.cpp \
     item_scene/pge_edit_scene_item.cpp \
     item_scene/pge_quad_tree.cpp \
-    key_dropper.cpp
+    item_scene/pge_scene_index.cpp \
+    item_scene/pge_tile_grid.cpp \
+    item_scene/pge_packed_rtree.cpp \
+    key_dropper.cpp \
+    benchmarks.cpp
 
 HEADERS  += \
     itemscene.h \
     item_scene/LooseQuadtree.h \
     item_scene/LooseQuadtree-impl.h \
+    item_scene/LooseQuadtree-simd.h \
     item_scene/pge_edit_scene.h \
     item_scene/pge_edit_scene_item.h \
     item_scene/pge_quad_tree.h \
+    item_scene/pge_scene_index.h \
+    item_scene/pge_tile_grid.h \
+    item_scene/pge_packed_rtree.h \
     key_dropper.h \
-    item_scene/pge_rect.h
+    item_scene/pge_rect.h \
+    benchmarks.h
 
 FORMS    += itemscene.ui
 
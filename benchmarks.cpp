@@ -0,0 +1,793 @@
+#include <QElapsedTimer>
+#include <QFile>
+#include <algorithm>
+#include <random>
+#include <memory>
+
+#include "benchmarks.h"
+#include "item_scene/pge_edit_scene_item.h"
+#include "item_scene/pge_quad_tree.h"
+#include "item_scene/pge_tile_grid.h"
+#include "item_scene/pge_packed_rtree.h"
+
+typedef PgeQuadTree::ItemsList ItemsList;
+
+//! Square grid of side * side elements of 32x32, every second one is shifted down by half of it
+static ItemsList makeSquareGrid(int side)
+{
+    ItemsList items;
+    items.reserve(side * side);
+    bool offset = false;
+    for(int row = 0; row < side; row++)
+    {
+        for(int column = 0; column < side; column++)
+        {
+            PGE_EditSceneItem *item = new PGE_EditSceneItem(nullptr);
+            item->m_posRect.setRect(column * 32 - 1024, row * 32 - 1024 + (offset ? 16 : 0), 32, 32);
+            items.push_back(item);
+            offset = !offset;
+        }
+    }
+    return items;
+}
+
+//! Same grid of elements as PGE_EditScene::initThread() makes
+static ItemsList makeGrid()
+{
+    return makeSquareGrid(1032);
+}
+
+//! Same layout as the "80 entries" demo of the main window makes
+static ItemsList makeDemoLayout()
+{
+    ItemsList items;
+    bool offset = false;
+    for(int y = -32; y < 480; y += 32)
+    {
+        for(int x = -32; x < 480; x += 32)
+        {
+            PGE_EditSceneItem *item = new PGE_EditSceneItem(nullptr);
+            item->m_posRect.setRect(x, y + (offset ? 16 : 0), 32, 32);
+            items.push_back(item);
+            offset = !offset;
+        }
+    }
+    return items;
+}
+
+static void destroyGrid(ItemsList &items)
+{
+    for(PGE_EditSceneItem *item : items)
+        delete item;
+    items.clear();
+}
+
+static double elapsedMs(const QElapsedTimer &timer)
+{
+    return double(timer.nsecsElapsed()) / 1000000.0;
+}
+
+static bool appendToList(PGE_EditSceneItem *item, void *context)
+{
+    static_cast<ItemsList *>(context)->push_back(item);
+    return true;
+}
+
+//! Areas of the size at random places of a square grid from makeSquareGrid() with the extent in pixels
+static std::vector<PGE_Rect<int64_t> > makeAreas(std::mt19937 &rng, int count, int64_t extent, int64_t width, int64_t height)
+{
+    std::vector<PGE_Rect<int64_t> > areas;
+    areas.reserve(count);
+    for(int i = 0; i < count; i++)
+    {
+        int64_t x = int64_t(rng() % uint64_t(std::max<int64_t>(extent - width, 1))) - 1024;
+        int64_t y = int64_t(rng() % uint64_t(std::max<int64_t>(extent - height, 1))) - 1024;
+        areas.emplace_back(x, y, width, height);
+    }
+    return areas;
+}
+
+//! Rounds of measureAreas(), the best one is taken
+static const int c_measureRounds = 5;
+
+//! Best of the rounds of one area operation on every area, in microseconds per area
+template<class Operation>
+static double measureAreas(const std::vector<PGE_Rect<int64_t> > &areas, Operation &&operation)
+{
+    double best = 0.0;
+    for(int round = 0; round < c_measureRounds; round++)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        for(const PGE_Rect<int64_t> &area : areas)
+            operation(area);
+        double perArea = elapsedMs(timer) * 1000.0 / areas.size();
+        if(round == 0 || perArea < best)
+            best = perArea;
+    }
+    return best;
+}
+
+QString SceneBenchmarks::bulkInsert()
+{
+    ItemsList items = makeGrid();
+    ItemsList shuffled = items;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(1));
+
+    QString report = QString("Loading of %1 items:\n").arg(items.size());
+    const ItemsList *orders[2] = {&items, &shuffled};
+    const char *orderNames[2] = {"row by row", "random order"};
+    for(int o = 0; o < 2; o++)
+    {
+        const ItemsList &list = *orders[o];
+        QElapsedTimer timer;
+        double perItem, bulk;
+        {
+            PgeQuadTree tree;
+            timer.start();
+            for(PGE_EditSceneItem *item : list)
+                tree.insert(item);
+            perItem = elapsedMs(timer);
+        }
+        {
+            PgeQuadTree tree;
+            timer.start();
+            tree.insertBulk(list);
+            bulk = elapsedMs(timer);
+        }
+        report += QString("%1: insert() %2 ms, insertBulk() %3 ms\n")
+                  .arg(orderNames[o]).arg(perItem, 0, 'f', 1).arg(bulk, 0, 'f', 1);
+    }
+
+    destroyGrid(items);
+    return report;
+}
+
+QString SceneBenchmarks::viewportQuery()
+{
+    ItemsList items = makeGrid();
+    PgeQuadTree tree;
+    tree.insertBulk(items);
+
+    std::mt19937 rng(3);
+    const int queries = 2000;
+    QString report = QString("%1 queries on %2 items:\n").arg(queries).arg(items.size());
+    // Window-sized view at zoom 100%, 25% and 6.25%
+    for(int zoomOut = 1; zoomOut <= 16; zoomOut *= 4)
+    {
+        std::vector<PGE_Rect<int64_t> > views;
+        views.reserve(queries);
+        for(int i = 0; i < queries; i++)
+            views.emplace_back(int64_t(rng() % 30000) - 1000, int64_t(rng() % 30000) - 1000, 1280 * zoomOut, 720 * zoomOut);
+
+        QElapsedTimer timer;
+        qint64 found = 0;
+        timer.start();
+        for(PGE_Rect<int64_t> &view : views)
+        {
+            ItemsList list;
+            tree.query(view, appendToList, &list);
+            found += list.size();
+        }
+        double callback = elapsedMs(timer);
+
+        ItemsList list;
+        timer.start();
+        for(PGE_Rect<int64_t> &view : views)
+        {
+            list.clear();
+            tree.query(view, &list);
+        }
+        double visitor = elapsedMs(timer);
+
+        report += QString("%1x%2 view (%3 items): callback %4 us, visitor into reused list %5 us per query\n")
+                  .arg(1280 * zoomOut).arg(720 * zoomOut).arg(found / queries)
+                  .arg(callback * 1000.0 / queries, 0, 'f', 1)
+                  .arg(visitor * 1000.0 / queries, 0, 'f', 1);
+    }
+
+    tree.clear();
+    destroyGrid(items);
+    return report;
+}
+
+//! Squared distance from the point to the element's rectangle (zero inside)
+static double squaredDistance(const PGE_EditSceneItem *item, int64_t x, int64_t y)
+{
+    const PGE_Rect<int64_t> &r = item->m_posRect;
+    double dx = x < r.left() ? double(r.left() - x) : (x > r.right() ? double(x - r.right()) : 0.0);
+    double dy = y < r.top() ? double(r.top() - y) : (y > r.bottom() ? double(y - r.bottom()) : 0.0);
+    return dx * dx + dy * dy;
+}
+
+QString SceneBenchmarks::nearestQuery()
+{
+    ItemsList items = makeGrid();
+    PgeQuadTree tree;
+    tree.insertBulk(items);
+
+    std::mt19937 rng(5);
+    const int queries = 20000;
+    const int64_t maxDistance = 4096;
+    std::vector<std::pair<int64_t, int64_t> > points;
+    points.reserve(queries);
+    for(int i = 0; i < queries; i++)
+        points.emplace_back(int64_t(rng() % 36000) - 3000, int64_t(rng() % 36000) - 3000);
+
+    QString report = QString("%1 queries on %2 items (up to %3 px away):\n").arg(queries).arg(items.size()).arg(qint64(maxDistance));
+    for(int k = 1; k <= 64; k *= 8)
+    {
+        QElapsedTimer timer;
+        qint64 found = 0;
+        ItemsList list;
+        timer.start();
+        for(const std::pair<int64_t, int64_t> &pt : points)
+        {
+            // Area around the point is doubled until it surely contains the k nearest
+            for(int64_t radius = 32; ; radius *= 2)
+            {
+                radius = std::min(radius, maxDistance);
+                list.clear();
+                tree.query(PGE_Rect<int64_t>(pt.first - radius, pt.second - radius, radius * 2 + 1, radius * 2 + 1), &list);
+                double limit = double(radius) * double(radius);
+                auto end = std::remove_if(list.begin(), list.end(), [&pt, limit](PGE_EditSceneItem *item)
+                {
+                    return squaredDistance(item, pt.first, pt.second) > limit;
+                });
+                list.erase(end, list.end());
+                if(list.size() >= k || radius == maxDistance)
+                    break;
+            }
+            std::sort(list.begin(), list.end(), [&pt](PGE_EditSceneItem *a, PGE_EditSceneItem *b)
+            {
+                return squaredDistance(a, pt.first, pt.second) < squaredDistance(b, pt.first, pt.second);
+            });
+            found += std::min(list.size(), k);
+        }
+        double growing = elapsedMs(timer);
+
+        qint64 foundNearest = 0;
+        timer.start();
+        for(const std::pair<int64_t, int64_t> &pt : points)
+        {
+            list.clear();
+            tree.nearest(pt.first, pt.second, k, maxDistance, &list);
+            foundNearest += list.size();
+        }
+        double nearest = elapsedMs(timer);
+
+        report += QString("k = %1 (%2/%3 found): growing areas %4 us, nearest() %5 us per query\n")
+                  .arg(k).arg(found).arg(foundNearest)
+                  .arg(growing * 1000.0 / queries, 0, 'f', 2)
+                  .arg(nearest * 1000.0 / queries, 0, 'f', 2);
+    }
+
+    tree.clear();
+    destroyGrid(items);
+    return report;
+}
+
+//! Timings of one backend on one layout, microseconds per operation
+struct IndexTimings
+{
+    double insert = 0.0;
+    double insertBulk = 0.0;
+    double viewport = 0.0;
+    double point = 0.0;
+    double nearest = 0.0;
+    double move = 0.0;
+    //! Percent of the moved elements which were updated in place
+    double movedInPlace = 0.0;
+    double remove = 0.0;
+    //! Milliseconds of optimize() after the moves
+    double optimize = 0.0;
+    //! 1280x720 query after the moves, before optimize()
+    double viewportEdited = 0.0;
+    qint64 found = 0;
+};
+
+static PgeSceneIndex *makeIndex(int backend)
+{
+    if(backend == 1)
+        return new PgeTileGrid;
+    if(backend == 2)
+        return new PgePackedRTree;
+    return new PgeQuadTree;
+}
+
+static IndexTimings measureIndex(int backend, ItemsList &items, int64_t width, int64_t height, int rounds)
+{
+    IndexTimings t;
+    QElapsedTimer timer;
+    std::mt19937 rng(7);
+    const int queries = 2000;
+    const double count = double(items.size());
+
+    {
+        std::unique_ptr<PgeSceneIndex> index(makeIndex(backend));
+        timer.start();
+        for(int r = 0; r < rounds; r++)
+        {
+            for(PGE_EditSceneItem *item : items)
+                index->insert(item);
+            if(r + 1 < rounds)
+                index->clear();
+        }
+        t.insert = elapsedMs(timer) * 1000.0 / (count * rounds);
+        index->clear();
+    }
+
+    std::unique_ptr<PgeSceneIndex> index(makeIndex(backend));
+    timer.start();
+    for(int r = 0; r < rounds; r++)
+    {
+        index->insertBulk(items);
+        if(r + 1 < rounds)
+            index->clear();
+    }
+    t.insertBulk = elapsedMs(timer) * 1000.0 / (count * rounds);
+
+    std::vector<PGE_Rect<int64_t> > views;
+    std::vector<std::pair<int64_t, int64_t> > points;
+    for(int i = 0; i < queries; i++)
+    {
+        int64_t x = int64_t(rng() % uint32_t(width + 1280)) - 1280;
+        int64_t y = int64_t(rng() % uint32_t(height + 720)) - 720;
+        views.emplace_back(x, y, 1280, 720);
+        points.emplace_back(x + 640, y + 360);
+    }
+
+    ItemsList list;
+    timer.start();
+    for(int r = 0; r < rounds; r++)
+    {
+        for(PGE_Rect<int64_t> &view : views)
+        {
+            list.clear();
+            index->query(view, &list);
+            t.found += list.size();
+        }
+    }
+    t.viewport = elapsedMs(timer) * 1000.0 / (double(queries) * rounds);
+    t.found /= qint64(queries) * rounds;
+
+    qint64 hits = 0;
+    timer.start();
+    for(int r = 0; r < rounds; r++)
+    {
+        for(const std::pair<int64_t, int64_t> &pt : points)
+            hits += index->queryPoint(pt.first, pt.second) ? 1 : 0;
+    }
+    t.point = elapsedMs(timer) * 1000.0 / (double(queries) * rounds);
+
+    timer.start();
+    for(int r = 0; r < rounds; r++)
+    {
+        for(const std::pair<int64_t, int64_t> &pt : points)
+        {
+            list.clear();
+            index->nearest(pt.first, pt.second, 8, 1024, &list);
+        }
+    }
+    t.nearest = elapsedMs(timer) * 1000.0 / (double(queries) * rounds);
+
+    // Drag a selection of 64 neighbours by a tile and back, as the mouse would do
+    const int moves = 500;
+    std::vector<PgeSceneIndex::ItemsSet> selections;
+    for(int i = 0; i < 16; i++)
+    {
+        PgeSceneIndex::ItemsSet selection;
+        size_t first = rng() % items.size();
+        for(size_t j = 0; j < 64; j++)
+            selection.insert(items[(first + j) % items.size()]);
+        selections.push_back(selection);
+    }
+    index->resetUpdateCounters();
+    timer.start();
+    for(int i = 0; i < moves; i++)
+    {
+        PgeSceneIndex::ItemsSet &selection = selections[i % selections.size()];
+        index->updateMany(selection, 32, 32);
+        index->updateMany(selection, -32, -32);
+    }
+    t.move = elapsedMs(timer) * 1000.0 / (moves * 2.0 * 64.0);
+    PgeSceneIndex::UpdateCounters moved = index->updateCounters();
+    if(moved.inPlace + moved.relinked > 0)
+        t.movedInPlace = 100.0 * double(moved.inPlace) / double(moved.inPlace + moved.relinked);
+
+    // Moved elements stay in a slower part of some indexes until they are optimized
+    timer.start();
+    for(int r = 0; r < rounds; r++)
+    {
+        for(PGE_Rect<int64_t> &view : views)
+        {
+            list.clear();
+            index->query(view, &list);
+        }
+    }
+    t.viewportEdited = elapsedMs(timer) * 1000.0 / (double(queries) * rounds);
+    timer.start();
+    index->optimize();
+    t.optimize = elapsedMs(timer);
+
+    ItemsList shuffled = items;
+    std::shuffle(shuffled.begin(), shuffled.end(), rng);
+    timer.start();
+    for(PGE_EditSceneItem *item : shuffled)
+        index->remove(item);
+    t.remove = elapsedMs(timer) * 1000.0 / count;
+
+    return t;
+}
+
+QString SceneBenchmarks::indexBackends()
+{
+    const char *backendNames[3] = {"loose quadtree", "tile grid", "packed R-tree"};
+    QString report;
+    for(int layout = 0; layout < 2; layout++)
+    {
+        ItemsList items = layout == 0 ? makeDemoLayout() : makeGrid();
+        int64_t width = layout == 0 ? 512 : 33024;
+        int rounds = layout == 0 ? 200 : 1;
+        report += QString("%1 layout, %2 items (times in us per item or per query):\n")
+                  .arg(layout == 0 ? "80 entries" : "Million entries").arg(items.size());
+        for(int backend = 0; backend < 3; backend++)
+        {
+            IndexTimings t = measureIndex(backend, items, width, width, rounds);
+            report += QString("%1: insert() %2, insertBulk() %3, 1280x720 query (%4 items) %5, "
+                              "queryPoint() %6, nearest(8) %7, updateMany() %8 (%9% in place), query after it %10, "
+                              "optimize() %11 ms, remove() %12\n")
+                      .arg(backendNames[backend])
+                      .arg(t.insert, 0, 'f', 3).arg(t.insertBulk, 0, 'f', 3)
+                      .arg(t.found).arg(t.viewport, 0, 'f', 2)
+                      .arg(t.point, 0, 'f', 3).arg(t.nearest, 0, 'f', 2)
+                      .arg(t.move, 0, 'f', 3).arg(t.movedInPlace, 0, 'f', 0).arg(t.viewportEdited, 0, 'f', 2)
+                      .arg(t.optimize, 0, 'f', 1).arg(t.remove, 0, 'f', 3);
+        }
+        destroyGrid(items);
+    }
+    return report;
+}
+
+QString SceneBenchmarks::viewportScaling()
+{
+    const int sides[3] = {316, 1000, 3162};
+    const int queries = 1000;
+    QString report = QString("Loose quadtree, %1 queries per view size (us per query, ns per found item):\n").arg(queries);
+    for(int side : sides)
+    {
+        ItemsList items = makeSquareGrid(side);
+        PgeQuadTree tree;
+        QElapsedTimer timer;
+        timer.start();
+        tree.insertBulk(items);
+        double load = elapsedMs(timer);
+        report += QString("%1 items, insertBulk() %2 ms:").arg(items.size()).arg(load, 0, 'f', 0);
+
+        std::mt19937 rng(5);
+        const int64_t extent = int64_t(side) * 32;
+        ItemsList list;
+        for(int zoomOut = 1; zoomOut <= 4; zoomOut *= 4)
+        {
+            const int64_t width = 1280 * zoomOut, height = 720 * zoomOut;
+            std::vector<PGE_Rect<int64_t> > views = makeAreas(rng, queries, extent, width, height);
+            qint64 found = 0;
+            timer.start();
+            for(PGE_Rect<int64_t> &view : views)
+            {
+                list.clear();
+                tree.query(view, &list);
+                found += list.size();
+            }
+            double total = elapsedMs(timer);
+            report += QString(" %1x%2 view (%3 items) %4 us, %5 ns;")
+                      .arg(qint64(width)).arg(qint64(height)).arg(found / queries)
+                      .arg(total * 1000.0 / queries, 0, 'f', 1)
+                      .arg(found > 0 ? total * 1000000.0 / double(found) : 0.0, 0, 'f', 1);
+        }
+        report += "\n";
+        tree.clear();
+        destroyGrid(items);
+    }
+    return report;
+}
+
+//! Resident memory of the process in KB, or -1 where /proc is not available
+static qint64 residentKb()
+{
+    QFile status("/proc/self/status");
+    if(!status.open(QIODevice::ReadOnly | QIODevice::Text))
+        return -1;
+    while(!status.atEnd())
+    {
+        QByteArray line = status.readLine();
+        if(line.startsWith("VmRSS:"))
+        {
+            QByteArray value = line.mid(6).simplified();
+            return value.left(value.indexOf(' ')).toLongLong();
+        }
+    }
+    return -1;
+}
+
+static QString memoryDelta(qint64 kb, qint64 baseKb)
+{
+    if(kb < 0 || baseKb < 0)
+        return QString("n/a");
+    return QString("%1 MB").arg(double(kb - baseKb) / 1024.0, 0, 'f', 1);
+}
+
+QString SceneBenchmarks::blocksAllocator()
+{
+    const int slotsCount = 1000000;
+    const size_t slotSize = sizeof(void *) * 4;
+    std::vector<void *> pointers(slotsCount);
+    std::vector<int> order(slotsCount);
+    for(int i = 0; i < slotsCount; i++)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+    QString report = QString("Allocation of %1 slots of %2 bytes, freeing in random order "
+                             "(ns per call, 3 rounds):\n").arg(slotsCount).arg(qint64(slotSize));
+    QElapsedTimer timer;
+    for(int kind = 0; kind < 2; kind++)
+    {
+        loose_quadtree::detail::BlocksAllocator allocator;
+        report += kind == 0 ? "blocks allocator:" : "new/delete:";
+        for(int round = 0; round < 3; round++)
+        {
+            timer.start();
+            for(int i = 0; i < slotsCount; i++)
+                pointers[i] = kind == 0 ? allocator.Allocate(slotSize) : ::operator new(slotSize);
+            double allocate = double(timer.nsecsElapsed()) / slotsCount;
+            timer.start();
+            for(int i : order)
+            {
+                if(kind == 0)
+                    allocator.Deallocate(pointers[i], slotSize);
+                else
+                    ::operator delete(pointers[i]);
+            }
+            double deallocate = double(timer.nsecsElapsed()) / slotsCount;
+            report += QString(" allocate %1, free %2;").arg(allocate, 0, 'f', 1).arg(deallocate, 0, 'f', 1);
+        }
+        report += "\n";
+    }
+
+    ItemsList items = makeGrid();
+    ItemsList shuffled = items;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(1));
+    report += QString("Loose quadtree with %1 items, memory over the items themselves:\n").arg(items.size());
+    qint64 baseKb = residentKb();
+    for(int round = 0; round < 3; round++)
+    {
+        std::unique_ptr<PgeQuadTree> tree(new PgeQuadTree);
+        timer.start();
+        tree->insertBulk(items);
+        double load = elapsedMs(timer);
+        qint64 loadedKb = residentKb();
+        timer.start();
+        for(PGE_EditSceneItem *item : shuffled)
+            tree->remove(item);
+        double removeAll = elapsedMs(timer);
+        timer.start();
+        tree.reset();
+        double destroy = elapsedMs(timer);
+        qint64 destroyedKb = residentKb();
+        report += QString("round %1: insertBulk() %2 ms (%3), remove() of all %4 ms, "
+                          "destruction %5 ms (%6 left)\n")
+                  .arg(round + 1).arg(load, 0, 'f', 1).arg(memoryDelta(loadedKb, baseKb))
+                  .arg(removeAll, 0, 'f', 1).arg(destroy, 0, 'f', 1)
+                  .arg(memoryDelta(destroyedKb, baseKb));
+    }
+
+    destroyGrid(items);
+    return report;
+}
+
+QString SceneBenchmarks::nodeScan()
+{
+    typedef loose_quadtree::detail::ObjectRecord<int64_t, PGE_EditSceneItem> Record;
+    typedef loose_quadtree::BoundingBox<int64_t> Box;
+    using loose_quadtree::detail::BoxKernel;
+    const int recordsCount = 1 << 16;
+    const int nodeSizes[5] = {2, 4, 12, 64, 256};
+    const int passes = 400;
+
+    // records as the nodes keep them, every eighth one removed, and 32x32 boxes scattered
+    // over 2048x2048 so about a quarter of them are in a 1280x720 view
+    PGE_EditSceneItem item(nullptr);
+    std::mt19937 rng(3);
+    std::vector<Record> records;
+    records.reserve(recordsCount);
+    for(int i = 0; i < recordsCount; i++)
+    {
+        Box bounds(int64_t(rng() % 2048), int64_t(rng() % 2048), 32, 32);
+        records.push_back(Record{i % 8 == 7 ? nullptr : &item, bounds});
+    }
+    std::vector<Box> views;
+    views.reserve(passes);
+    for(int i = 0; i < passes; i++)
+        views.emplace_back(int64_t(rng() % 768), int64_t(rng() % 1328), 1280, 720);
+
+    const BoxKernel kernels[3] = {BoxKernel::kScalar, BoxKernel::kSse2, BoxKernel::kAvx2};
+    const char *kernelNames[3] = {"scalar mask", "SSE2", "AVX2"};
+    QString report = QString("Scan of %1 records split into nodes, against %2 views "
+                             "(ns per record, speedup over the per-record loop):\n")
+                     .arg(recordsCount).arg(passes);
+    QElapsedTimer timer;
+    for(int nodeSize : nodeSizes)
+    {
+        qint64 expected = 0;
+        timer.start();
+        for(const Box &view : views)
+        {
+            for(int first = 0; first < recordsCount; first += nodeSize)
+            {
+                for(int r = first; r < first + nodeSize; r++)
+                {
+                    if(records[r].object == nullptr || !view.Intersects(records[r].bounds))
+                        continue;
+                    expected++;
+                }
+            }
+        }
+        const double scanned = double(recordsCount) * passes;
+        double loop = double(timer.nsecsElapsed()) / scanned;
+        report += QString("nodes of %1: per-record loop %2 ns;").arg(nodeSize).arg(loop, 0, 'f', 2);
+
+        for(int k = 0; k < 3; k++)
+        {
+            if(!loose_quadtree::detail::IsBoxKernelAvailable(kernels[k]))
+            {
+                report += QString(" %1 n/a;").arg(kernelNames[k]);
+                continue;
+            }
+            qint64 found = 0;
+            timer.start();
+            for(const Box &view : views)
+            {
+                for(int first = 0; first < recordsCount; first += nodeSize)
+                {
+                    for(int batch = first; batch < first + nodeSize; batch += loose_quadtree::detail::kMaskedBoxes)
+                    {
+                        const int count = std::min(first + nodeSize - batch, loose_quadtree::detail::kMaskedBoxes);
+                        unsigned long long hits = loose_quadtree::detail::IntersectingMask(
+                                                      &records[batch].bounds, sizeof(Record), count, view, kernels[k]);
+                        for(; hits != 0; hits &= hits - 1)
+                        {
+                            if(records[batch + loose_quadtree::detail::LowestBitIndex(hits)].object != nullptr)
+                                found++;
+                        }
+                    }
+                }
+            }
+            double kernel = double(timer.nsecsElapsed()) / scanned;
+            report += QString(" %1 %2 ns (x%3)%4;").arg(kernelNames[k]).arg(kernel, 0, 'f', 2)
+                      .arg(loop / kernel, 0, 'f', 1).arg(found == expected ? "" : " MISMATCH");
+        }
+        report += "\n";
+    }
+    report += QString("The tree uses %1\n").arg(kernelNames[int(loose_quadtree::detail::FastestBoxKernel())]);
+    return report;
+}
+
+//! Microseconds per query() of the views by measureAreas(), the found items of one round go into found
+static double measureViews(const PgeQuadTree &tree, const std::vector<PGE_Rect<int64_t> > &views, qint64 *found)
+{
+    ItemsList list;
+    *found = 0;
+    double best = measureAreas(views, [&](const PGE_Rect<int64_t> &view)
+    {
+        list.clear();
+        tree.query(view, &list);
+        *found += list.size();
+    });
+    *found /= c_measureRounds;
+    return best;
+}
+
+QString SceneBenchmarks::removalQueries()
+{
+    const int queries = 1000;
+    const int compactBatch = 4096;
+    ItemsList items = makeGrid();
+    PgeQuadTree tree;
+    tree.insertBulk(items);
+
+    std::mt19937 rng(3);
+    std::vector<PGE_Rect<int64_t> > views = makeAreas(rng, queries, 1032 * 32, 1280, 720);
+
+    QString report = QString("Loose quadtree with %1 items, %2 queries of 1280x720 views (us per query, best of %3 rounds):\n")
+                     .arg(items.size()).arg(queries).arg(c_measureRounds);
+    qint64 found;
+    double full = measureViews(tree, views, &found);
+    report += QString("all items: %1 us (%2 items per view)\n").arg(full, 0, 'f', 1).arg(found / queries);
+
+    ItemsList shuffled = items;
+    std::shuffle(shuffled.begin(), shuffled.end(), rng);
+    shuffled.resize(shuffled.size() / 2);
+    QElapsedTimer timer;
+    timer.start();
+    for(PGE_EditSceneItem *item : shuffled)
+        tree.remove(item);
+    double removal = elapsedMs(timer);
+    double removed = measureViews(tree, views, &found);
+    report += QString("half removed at random (remove() %1 ms): %2 us (%3 items per view)\n")
+              .arg(removal, 0, 'f', 0).arg(removed, 0, 'f', 1).arg(found / queries);
+
+    int steps = 0;
+    double longestStep = 0.0;
+    timer.start();
+    while(tree.needsCompact())
+    {
+        QElapsedTimer step;
+        step.start();
+        bool done = tree.compactStep(compactBatch);
+        longestStep = std::max(longestStep, elapsedMs(step));
+        steps++;
+        if(done)
+            break;
+    }
+    double compaction = elapsedMs(timer);
+    double compacted = measureViews(tree, views, &found);
+    report += QString("compacted (%1 steps of %2 elements, %3 ms, longest step %4 ms): %5 us\n")
+              .arg(steps).arg(compactBatch).arg(compaction, 0, 'f', 0).arg(longestStep, 0, 'f', 1)
+              .arg(compacted, 0, 'f', 1);
+
+    tree.clear();
+    destroyGrid(items);
+    return report;
+}
+
+QString SceneBenchmarks::areaCount()
+{
+    const int queries = 100;
+    ItemsList items = makeGrid();
+    PgeQuadTree tree;
+    tree.insertBulk(items);
+
+    std::mt19937 rng(5);
+    const int64_t extent = 1032 * 32;
+    QString report = QString("Loose quadtree with %1 items, %2 areas of every size (us per area, best of %3 rounds):\n")
+                     .arg(items.size()).arg(queries).arg(c_measureRounds);
+    qint64 sink = 0;
+    for(int64_t side = 1024; side <= extent / 2; side *= 4)
+    {
+        std::vector<PGE_Rect<int64_t> > areas = makeAreas(rng, queries, extent, side, side);
+
+        qint64 found = 0;
+        double counted = measureAreas(areas, [&](const PGE_Rect<int64_t> &area)
+        {
+            tree.query(area, [&found](PGE_EditSceneItem *)
+            {
+                found++;
+                return true;
+            });
+        });
+        double countIn = measureAreas(areas, [&](const PGE_Rect<int64_t> &area)
+        {
+            sink += tree.countIn(area);
+        });
+        double bounded = measureAreas(areas, [&](const PGE_Rect<int64_t> &area)
+        {
+            PGE_Rect<int64_t> bounds;
+            tree.PgeSceneIndex::boundsIn(area, &bounds);
+            sink += bounds.width();
+        });
+        double boundsIn = measureAreas(areas, [&](const PGE_Rect<int64_t> &area)
+        {
+            PGE_Rect<int64_t> bounds;
+            tree.boundsIn(area, &bounds);
+            sink += bounds.width();
+        });
+        report += QString("%1x%1 (%2 items): count by query() %3 us, countIn() %4 us, bounds by query() %5 us, boundsIn() %6 us\n")
+                  .arg(qint64(side)).arg(found / (queries * c_measureRounds)).arg(counted, 0, 'f', 1).arg(countIn, 0, 'f', 1)
+                  .arg(bounded, 0, 'f', 1).arg(boundsIn, 0, 'f', 1);
+    }
+    report += QString("(checksum %1)\n").arg(sink);
+
+    tree.clear();
+    destroyGrid(items);
+    return report;
+}
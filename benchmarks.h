@@ -0,0 +1,60 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <QString>
+
+/**
+ * Measurements of the scene's spatial index, are launched from the "Benchmarks" menu
+ */
+namespace SceneBenchmarks
+{
+    /**
+     * @brief Compare one-by-one insert() and insertBulk() on the million items grid
+     * @return Human-readable report
+     */
+    QString bulkInsert();
+    /**
+     * @brief Compare callback-based and visitor-based query() with viewport-sized areas
+     * @return Human-readable report
+     */
+    QString viewportQuery();
+    /**
+     * @brief Compare nearest() with growing area queries, as snapping would need them
+     * @return Human-readable report
+     */
+    QString nearestQuery();
+    /**
+     * @brief Compare the loose quadtree, the tile grid and the packed R-tree on layouts of the 80 and the million entries demos
+     * @return Human-readable report
+     */
+    QString indexBackends();
+    /**
+     * @brief Measure viewport queries of the loose quadtree on grids of 100 thousand, 1 million and 10 million items
+     * @return Human-readable report
+     */
+    QString viewportScaling();
+    /**
+     * @brief Measure the loose quadtree's blocks allocator against new/delete, and the memory
+     * taken by the million items tree over several load and teardown rounds
+     * @return Human-readable report
+     */
+    QString blocksAllocator();
+    /**
+     * @brief Compare the per-record loop with the batched (scalar, SSE2 and AVX2) box tests on node-sized record arrays
+     * @return Human-readable report
+     */
+    QString nodeScan();
+    /**
+     * @brief Measure viewport queries of the loose quadtree on the million items grid, whole, with half of it removed at random, and compacted
+     * @return Human-readable report
+     */
+    QString removalQueries();
+    /**
+     * @brief Compare counting and bounding the items of growing areas of the million items grid by query()
+     * with countIn() and boundsIn(), which take the subtrees inside of the area from the node summaries
+     * @return Human-readable report
+     */
+    QString areaCount();
+}
+
+#endif // BENCHMARKS_H
@@ -2,17 +2,21 @@
 #define LOOSEQUADTREE_LOOSEQUADTREE_IMPL_H
 
 #include "LooseQuadtree.h"
+#include "LooseQuadtree-simd.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
-#include <deque>
-#include <forward_list>
+#include <functional>
+#include <iterator>
 #include <limits>
-#include <map>
 #include <memory>
+#include <queue>
 #include <unordered_map>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace loose_quadtree {
@@ -20,14 +24,19 @@ namespace detail {
 
 
 
+// Nodes and object lists are taken from blocks of fixed-size slots, define
+// LQT_NO_OWN_ALLOCATOR to use new/delete for every one of them instead
+#if !defined(LQT_USE_OWN_ALLOCATOR) && !defined(LQT_NO_OWN_ALLOCATOR)
 #define LQT_USE_OWN_ALLOCATOR
+#endif
 
 
 class BlocksAllocator {
 public:
 	const static std::size_t kBlockAlign = alignof(long double);
 	const static std::size_t kBlockSize = 16384;
-	const static std::size_t kMaxAllowedAlloc = sizeof(void*) * 8;
+	const static std::size_t kMaxAllowedAlloc = sizeof(void*) * 12;
+	const static std::size_t kSizeClasses = kMaxAllowedAlloc / sizeof(void*);
 
 	BlocksAllocator();
 	~BlocksAllocator();
@@ -37,6 +46,8 @@ public:
 	void* Allocate(std::size_t object_size);
 	void Deallocate(void* p, std::size_t object_size);
 	void ReleaseFreeBlocks();
+	void ReleaseFreeBlocks(std::size_t size_class); ///< only of one size class, a part of the work
+	void CountBlocks(std::size_t* used_blocks, std::size_t* free_blocks) const;
 	template <typename T, typename... Args>
 	T* New(Args&&... args);
 	template <typename T>
@@ -45,26 +56,21 @@ public:
 private:
 	using Block = std::aligned_storage<kBlockSize, kBlockAlign>::type;
 
-	//template <std::size_t kSizeT>
-	//union Slot {
-	//	Slot* next_empty_slot;
-	//	std::array<char, kSizeT> data;
-	//};
-
-	using BlocksAndEmptySlots = std::map<Block*, std::size_t>;
-
+	// Allocate() and Deallocate() only pop and push the list of empty slots in O(1), only
+	// ReleaseFreeBlocks() has to find the blocks of slots, it sorts the blocks for that
 	struct BlocksHead {
-		BlocksAndEmptySlots address_to_empty_slot_number;
-		void* first_empty_slot;
-		std::size_t slots_in_a_block_;
-
-		BlocksHead(std::size_t object_size) {
-			first_empty_slot = nullptr;
-			slots_in_a_block_ = kBlockSize / object_size;
-		}
+		std::vector<Block*> blocks;
+		void* first_empty_slot = nullptr; ///< empty slots of all blocks, linked through the slots
+		std::size_t used_slots = 0;
 	};
 
-	std::map<std::size_t, BlocksHead> size_to_blocks_;
+	static std::size_t SizeClass(std::size_t object_size);
+	static std::vector<std::size_t> CountEmptySlots(const std::vector<Block*>& sorted_blocks,
+		void* first_empty_slot);
+	static std::size_t FindBlock(const std::vector<Block*>& sorted_blocks, void* slot,
+		std::size_t guess);
+
+	std::array<BlocksHead, kSizeClasses> size_to_blocks_;
 };
 
 
@@ -105,63 +111,46 @@ struct BlocksAllocatorAdaptor {
 };
 
 
-BlocksAllocator::BlocksAllocator() {}
+inline BlocksAllocator::BlocksAllocator() {}
 
 
-BlocksAllocator::~BlocksAllocator() {
-	for (auto& size_block_pair : size_to_blocks_) {
-		BlocksHead& blocks_head = size_block_pair.second;
-		for (auto& address_empty_pair : blocks_head.address_to_empty_slot_number) {
-			assert(address_empty_pair.second == blocks_head.slots_in_a_block_);
-			Block* block = address_empty_pair.first;
+inline BlocksAllocator::~BlocksAllocator() {
+	for (BlocksHead& blocks_head : size_to_blocks_) {
+		assert(blocks_head.used_slots == 0);
+		for (Block* block : blocks_head.blocks) {
 			delete block;
 		}
 	}
 }
 
 
-void* BlocksAllocator::Allocate(std::size_t object_size) {
-#ifdef LQT_USE_OWN_ALLOCATOR
-	if (object_size < sizeof(void*)) object_size = sizeof(void*);
+inline std::size_t BlocksAllocator::SizeClass(std::size_t object_size) {
 	assert(object_size <= kMaxAllowedAlloc);
-	auto size_blocks_it = size_to_blocks_.find(object_size);
-	if (size_blocks_it == size_to_blocks_.end()) {
-		size_blocks_it = size_to_blocks_.emplace(object_size, object_size).first;
-	}
-	BlocksHead& blocks_head = size_blocks_it->second;
-	assert(blocks_head.slots_in_a_block_ == kBlockSize / object_size);
+	// sizes are rounded up to whole pointers, a slot must hold the link to the next empty one
+	return object_size <= sizeof(void*) ? 0 : (object_size - 1) / sizeof(void*);
+}
+
+
+inline void* BlocksAllocator::Allocate(std::size_t object_size) {
+#ifdef LQT_USE_OWN_ALLOCATOR
+	const std::size_t size_class = SizeClass(object_size);
+	BlocksHead& blocks_head = size_to_blocks_[size_class];
 	if (blocks_head.first_empty_slot == nullptr) {
+		const std::size_t slot_size = (size_class + 1) * sizeof(void*);
+		const std::size_t slot_count = kBlockSize / slot_size;
 		Block* new_block = new Block();
-		std::size_t empties = blocks_head.slots_in_a_block_;
-		blocks_head.address_to_empty_slot_number.emplace(new_block, empties);
-		blocks_head.first_empty_slot = reinterpret_cast<void*>(new_block);
-		void* current_slot = reinterpret_cast<void*>(new_block);
-		empties--;
-		while (empties > 0) {
-			void* next_slot =
-				reinterpret_cast<void*>(reinterpret_cast<char*>(current_slot)
-						+ object_size);
-			*reinterpret_cast<void**>(current_slot) = next_slot;
-			current_slot = next_slot;
-			empties--;
-		}
-		*reinterpret_cast<void**>(current_slot) = nullptr;
-	}
-	assert(blocks_head.first_empty_slot != nullptr);
+		blocks_head.blocks.push_back(new_block);
+		// slots are linked in the address order, so they are handed out in it
+		char* slot = reinterpret_cast<char*>(new_block);
+		blocks_head.first_empty_slot = slot;
+		for (std::size_t i = 1; i < slot_count; i++, slot += slot_size) {
+			*reinterpret_cast<void**>(slot) = slot + slot_size;
+		}
+		*reinterpret_cast<void**>(slot) = nullptr;
+	}
 	void* slot = blocks_head.first_empty_slot;
 	blocks_head.first_empty_slot = *reinterpret_cast<void**>(slot);
-	auto address_empties_it =
-		blocks_head.address_to_empty_slot_number.upper_bound(reinterpret_cast<Block*>(slot));
-	assert(address_empties_it != blocks_head.address_to_empty_slot_number.begin());
-	address_empties_it--;
-	assert(address_empties_it->first <= reinterpret_cast<Block*>(slot) &&
-		(std::size_t)(reinterpret_cast<char*>(slot) -
-			reinterpret_cast<char*>(address_empties_it->first)) < kBlockSize);
-	assert((std::size_t)(reinterpret_cast<char*>(slot) -
-		reinterpret_cast<char*>(address_empties_it->first)) % object_size == 0);
-	assert(address_empties_it->second > 0 &&
-			address_empties_it->second <= blocks_head.slots_in_a_block_);
-	address_empties_it->second--;
+	blocks_head.used_slots++;
 	return slot;
 #else
 	return reinterpret_cast<void*>(new char[object_size]);
@@ -169,30 +158,13 @@ void* BlocksAllocator::Allocate(std::size_t object_size) {
 }
 
 
-void BlocksAllocator::Deallocate(void* p, std::size_t object_size) {
+inline void BlocksAllocator::Deallocate(void* p, std::size_t object_size) {
 #ifdef LQT_USE_OWN_ALLOCATOR
-	if (object_size < sizeof(void*)) object_size = sizeof(void*);
-	assert(object_size <= kMaxAllowedAlloc);
-	auto size_blocks_it = size_to_blocks_.find(object_size);
-	assert(size_blocks_it != size_to_blocks_.end());
-	BlocksHead& blocks_head = size_blocks_it->second;
-	assert(blocks_head.slots_in_a_block_ == kBlockSize / object_size);
-	auto address_empties_it =
-		blocks_head.address_to_empty_slot_number.upper_bound(reinterpret_cast<Block*>(p));
-	assert(address_empties_it != blocks_head.address_to_empty_slot_number.begin());
-	address_empties_it--;
-	assert(address_empties_it->first <= reinterpret_cast<Block*>(p) &&
-		(std::size_t)(reinterpret_cast<char*>(p) -
-			reinterpret_cast<char*>(address_empties_it->first)) < kBlockSize);
-	assert((std::size_t)(reinterpret_cast<char*>(p) -
-		reinterpret_cast<char*>(address_empties_it->first)) % object_size == 0);
-	assert(address_empties_it->second < blocks_head.slots_in_a_block_);
-	void* slot = p;
-	*reinterpret_cast<void**>(slot) = blocks_head.first_empty_slot;
-	blocks_head.first_empty_slot = slot;
-	address_empties_it->second++;
-	assert(address_empties_it->second > 0 &&
-			address_empties_it->second <= blocks_head.slots_in_a_block_);
+	BlocksHead& blocks_head = size_to_blocks_[SizeClass(object_size)];
+	assert(blocks_head.used_slots > 0);
+	blocks_head.used_slots--;
+	*reinterpret_cast<void**>(p) = blocks_head.first_empty_slot;
+	blocks_head.first_empty_slot = p;
 #else
 	(void)object_size;
 	delete[] reinterpret_cast<char*>(p);
@@ -200,43 +172,91 @@ void BlocksAllocator::Deallocate(void* p, std::size_t object_size) {
 }
 
 
-void BlocksAllocator::ReleaseFreeBlocks() {
-	for (auto& size_block_pair : size_to_blocks_) {
-		BlocksHead& blocks_head = size_block_pair.second;
-		void** current = &blocks_head.first_empty_slot;
-		while (*current != nullptr) {
-			auto address_empties_it =
-				blocks_head.address_to_empty_slot_number.upper_bound(reinterpret_cast<Block*>(*current));
-			assert(address_empties_it != blocks_head.address_to_empty_slot_number.begin());
-			address_empties_it--;
-			assert(address_empties_it->first <= reinterpret_cast<Block*>(*current) &&
-				(std::size_t)(reinterpret_cast<char*>(*current) -
-					reinterpret_cast<char*>(address_empties_it->first)) < kBlockSize);
-			assert((std::size_t)(reinterpret_cast<char*>(*current) -
-				reinterpret_cast<char*>(address_empties_it->first)) % size_block_pair.first == 0);
-			assert(address_empties_it->second > 0 &&
-					address_empties_it->second <= blocks_head.slots_in_a_block_);
-			if (address_empties_it->second >= blocks_head.slots_in_a_block_) {
-				*current = **reinterpret_cast<void***>(current);
-			}
-			else {
-				current = *reinterpret_cast<void***>(current);
-			}
+inline void BlocksAllocator::ReleaseFreeBlocks() {
+	for (std::size_t size_class = 0; size_class < kSizeClasses; size_class++) {
+		ReleaseFreeBlocks(size_class);
+	}
+}
+
+inline void BlocksAllocator::ReleaseFreeBlocks(std::size_t size_class) {
+	assert(size_class < kSizeClasses);
+	BlocksHead& blocks_head = size_to_blocks_[size_class];
+	if (blocks_head.blocks.empty()) {
+		return;
+	}
+	const std::size_t slot_count = kBlockSize / ((size_class + 1) * sizeof(void*));
+	std::vector<Block*>& blocks = blocks_head.blocks;
+	std::sort(blocks.begin(), blocks.end(), std::less<Block*>());
+	std::vector<std::size_t> empties = CountEmptySlots(blocks, blocks_head.first_empty_slot);
+	// empty slots of the blocks without used ones leave the list, then the blocks are freed
+	std::size_t last_block = 0;
+	void** current = &blocks_head.first_empty_slot;
+	while (*current != nullptr) {
+		last_block = FindBlock(blocks, *current, last_block);
+		if (empties[last_block] == slot_count) {
+			*current = *reinterpret_cast<void**>(*current);
+		}
+		else {
+			current = reinterpret_cast<void**>(*current);
 		}
-		auto address_empties_it = blocks_head.address_to_empty_slot_number.begin();
-		while (address_empties_it != blocks_head.address_to_empty_slot_number.end()) {
-			if (address_empties_it->second >= blocks_head.slots_in_a_block_) {
-				auto prev_address_empties_it = address_empties_it;
-				address_empties_it++;
-				blocks_head.address_to_empty_slot_number.erase(prev_address_empties_it);
+	}
+	std::size_t kept = 0;
+	for (std::size_t i = 0; i < blocks.size(); i++) {
+		if (empties[i] == slot_count) {
+			delete blocks[i];
+		}
+		else {
+			blocks[kept++] = blocks[i];
+		}
+	}
+	blocks.resize(kept);
+}
+
+inline void BlocksAllocator::CountBlocks(std::size_t* used_blocks, std::size_t* free_blocks) const {
+	*used_blocks = 0;
+	*free_blocks = 0;
+	for (std::size_t size_class = 0; size_class < kSizeClasses; size_class++) {
+		const BlocksHead& blocks_head = size_to_blocks_[size_class];
+		const std::size_t slot_count = kBlockSize / ((size_class + 1) * sizeof(void*));
+		std::vector<Block*> blocks = blocks_head.blocks;
+		std::sort(blocks.begin(), blocks.end(), std::less<Block*>());
+		for (std::size_t empty_slots : CountEmptySlots(blocks, blocks_head.first_empty_slot)) {
+			if (empty_slots == slot_count) {
+				++*free_blocks;
 			}
 			else {
-				address_empties_it++;
+				++*used_blocks;
 			}
 		}
 	}
 }
 
+inline std::vector<std::size_t> BlocksAllocator::CountEmptySlots(
+		const std::vector<Block*>& sorted_blocks, void* first_empty_slot) {
+	std::vector<std::size_t> empties(sorted_blocks.size(), 0);
+	std::size_t last_block = 0;
+	for (void* slot = first_empty_slot; slot != nullptr; slot = *reinterpret_cast<void**>(slot)) {
+		last_block = FindBlock(sorted_blocks, slot, last_block);
+		empties[last_block]++;
+	}
+	return empties;
+}
+
+inline std::size_t BlocksAllocator::FindBlock(const std::vector<Block*>& sorted_blocks,
+		void* slot, std::size_t guess) {
+	// neighbouring slots of the list are mostly freed together, from the same block
+	char* address = reinterpret_cast<char*>(slot);
+	char* guessed = reinterpret_cast<char*>(sorted_blocks[guess]);
+	if (std::less<char*>()(address, guessed) ||
+			!std::less<char*>()(address, guessed + kBlockSize)) {
+		auto it = std::upper_bound(sorted_blocks.begin(), sorted_blocks.end(),
+			reinterpret_cast<Block*>(slot), std::less<Block*>());
+		assert(it != sorted_blocks.begin());
+		return std::size_t(it - sorted_blocks.begin() - 1);
+	}
+	return guess;
+}
+
 
 template <typename T, typename... Args>
 T* BlocksAllocator::New(Args&&... args) {
@@ -308,6 +328,84 @@ struct MakeDistance<long double> { using Type = long double;};
 
 
 
+enum class VisitFit {kNoFit, kPartialFit, kFreeRide};
+
+enum class NodeVisit {kStop, kSkipChildren, kVisitChildren};
+
+
+
+inline int LowestBitIndex(unsigned long long bits) {
+	assert(bits != 0);
+#if defined(__GNUC__)
+	return __builtin_ctzll(bits);
+#else
+	int index = 0;
+	while ((bits & 1) == 0) {
+		bits >>= 1;
+		index++;
+	}
+	return index;
+#endif
+}
+
+
+
+template <typename NumberT>
+double SquaredDistance(const BoundingBox<NumberT>& box, NumberT x, NumberT y) {
+	// in double, the difference of two far integral coordinates would overflow squared
+	double dx = 0.0;
+	double dy = 0.0;
+	if (x < box.left) {
+		dx = (double)box.left - (double)x;
+	}
+	else if (x > box.left + box.width) {
+		dx = (double)x - (double)(box.left + box.width);
+	}
+	if (y < box.top) {
+		dy = (double)box.top - (double)y;
+	}
+	else if (y > box.top + box.height) {
+		dy = (double)y - (double)(box.top + box.height);
+	}
+	return dx * dx + dy * dy;
+}
+
+template <typename NumberT>
+bool SegmentEntry(const BoundingBox<NumberT>& box, NumberT x1, NumberT y1,
+		NumberT x2, NumberT y2, double* entry) {
+	// clips the segment with both slabs of the box, the entry is the fraction of the
+	// segment before the box (zero if it starts inside)
+	const double starts[2] = {(double)x1, (double)y1};
+	const double deltas[2] = {(double)x2 - (double)x1, (double)y2 - (double)y1};
+	const double lows[2] = {(double)box.left, (double)box.top};
+	const double highs[2] = {(double)box.left + (double)box.width,
+		(double)box.top + (double)box.height};
+	double enter = 0.0;
+	double exit = 1.0;
+	for (int axis = 0; axis < 2; axis++) {
+		if (deltas[axis] == 0.0) {
+			if (starts[axis] < lows[axis] || starts[axis] > highs[axis]) {
+				return false;
+			}
+			continue;
+		}
+		double low = (lows[axis] - starts[axis]) / deltas[axis];
+		double high = (highs[axis] - starts[axis]) / deltas[axis];
+		if (low > high) {
+			std::swap(low, high);
+		}
+		enter = std::max(enter, low);
+		exit = std::min(exit, high);
+		if (enter > exit) {
+			return false;
+		}
+	}
+	*entry = enter;
+	return true;
+}
+
+
+
 enum class ChildPosition {
 	kNone,
 	kTopLeft,
@@ -316,28 +414,380 @@ enum class ChildPosition {
 	kBottomLeft,
 };
 
+template <typename NumberT>
+std::array<BoundingBox<NumberT>, 4> QuarterBounds(const BoundingBox<NumberT>& bounds) {
+	// in the order of ChildPosition, the right and the bottom ones get the odd unit
+	NumberT half_width = (NumberT)((typename MakeDistance<NumberT>::Type)bounds.width / 2);
+	NumberT half_height = (NumberT)((typename MakeDistance<NumberT>::Type)bounds.height / 2);
+	NumberT right_width = (NumberT)(bounds.width - half_width);
+	NumberT bottom_height = (NumberT)(bounds.height - half_height);
+	NumberT center_x = (NumberT)(bounds.left + half_width);
+	NumberT center_y = (NumberT)(bounds.top + half_height);
+	return {{
+		BoundingBox<NumberT>(bounds.left, bounds.top, half_width, half_height),
+		BoundingBox<NumberT>(center_x, bounds.top, right_width, half_height),
+		BoundingBox<NumberT>(center_x, center_y, right_width, bottom_height),
+		BoundingBox<NumberT>(bounds.left, center_y, half_width, bottom_height)}};
+}
 
 
-template <typename ObjectT>
+
+template <typename NumberT, typename ObjectT>
+struct ObjectRecord {
+	ObjectT* object; ///< nullptr if removed while queries were open, first so the slot of a
+	///< handle is the record too
+	BoundingBox<NumberT> bounds; ///< copy of the object's, searches don't touch the object
+};
+
+template <typename NumberT, typename ObjectT>
+ObjectRecord<NumberT, ObjectT>* RecordOfSlot(ObjectT** slot) {
+	static_assert(std::is_standard_layout<ObjectRecord<NumberT, ObjectT>>::value,
+		"the slot must be the address of the record");
+	return reinterpret_cast<ObjectRecord<NumberT, ObjectT>*>(slot);
+}
+
+template <typename NumberT>
+struct IntersectsRegion {
+	explicit IntersectsRegion(const BoundingBox<NumberT>& _region) :
+		region(_region), kernel(FastestBoxKernel()) {}
+	bool operator()(const BoundingBox<NumberT>& object_bounds) const {
+		return region.Intersects(object_bounds);
+	}
+	const BoundingBox<NumberT>& region;
+	BoxKernel kernel; ///< chosen once for a whole search
+};
+
+template <typename NumberT>
+struct IntersectingNodes {
+	explicit IntersectingNodes(const BoundingBox<NumberT>& _region) : region(_region) {}
+	VisitFit operator()(const BoundingBox<NumberT>& node_bounds,
+			const BoundingBox<NumberT>& extended_bounds) const {
+		// the node fitting of the kIntersects query
+		if (!region.Intersects(extended_bounds)) {
+			return VisitFit::kNoFit;
+		}
+		else if (region.Contains(node_bounds)) {
+			return VisitFit::kFreeRide;
+		}
+		return VisitFit::kPartialFit;
+	}
+	const BoundingBox<NumberT>& region;
+};
+
+template <typename NumberT, typename ObjectT, typename ObjectFitter>
+unsigned long long FittingRecordsMask(const ObjectRecord<NumberT, ObjectT>* records, int count,
+		const ObjectFitter& object_fits) {
+	// bit i is set if records[i] fits, the removed ones are tested too (with their old bounds)
+	assert(count <= kMaskedBoxes);
+	unsigned long long mask = 0;
+	for (int i = 0; i < count; i++) {
+		mask |= (unsigned long long)object_fits(records[i].bounds) << i;
+	}
+	return mask;
+}
+
+template <typename NumberT, typename ObjectT>
+unsigned long long FittingRecordsMask(const ObjectRecord<NumberT, ObjectT>* records, int count,
+		const IntersectsRegion<NumberT>& object_fits) {
+	return IntersectingMask(&records->bounds, sizeof(*records), count, object_fits.region,
+		object_fits.kernel);
+}
+
+
+
+template <typename NumberT>
+struct NodeSummary {
+	NodeSummary() : count(0), exact(true), bounds(0, 0, 0, 0) {}
+
+	int count; ///< objects in the subtree, the removed ones are left out at once
+	bool exact; ///< else bounds only contain the objects, until a cleanup shrinks it
+	BoundingBox<NumberT> bounds; ///< of all the objects in the subtree, if any
+};
+
+template <typename NumberT>
+void UniteBounds(BoundingBox<NumberT>* bounds, const BoundingBox<NumberT>& other) {
+	NumberT right = std::max((NumberT)(bounds->left + bounds->width),
+		(NumberT)(other.left + other.width));
+	NumberT bottom = std::max((NumberT)(bounds->top + bounds->height),
+		(NumberT)(other.top + other.height));
+	bounds->left = std::min(bounds->left, other.left);
+	bounds->top = std::min(bounds->top, other.top);
+	bounds->width = (NumberT)(right - bounds->left);
+	bounds->height = (NumberT)(bottom - bounds->top);
+}
+
+template <typename NumberT>
+void AddToSummary(NodeSummary<NumberT>* summary, const BoundingBox<NumberT>& object_bounds) {
+	if (summary->count++ == 0) {
+		summary->bounds = object_bounds;
+		return;
+	}
+	UniteBounds(&summary->bounds, object_bounds);
+}
+
+template <typename NumberT>
+void MergeSummaries(NodeSummary<NumberT>* summary, const NodeSummary<NumberT>& other) {
+	if (other.count == 0) {
+		return;
+	}
+	if (summary->count == 0) {
+		*summary = other;
+		return;
+	}
+	summary->count += other.count;
+	summary->exact = summary->exact && other.exact;
+	UniteBounds(&summary->bounds, other.bounds);
+}
+
+template <typename NumberT>
+bool TouchesEdge(const BoundingBox<NumberT>& bounds, const BoundingBox<NumberT>& object_bounds) {
+	// the bounds could shrink without the object
+	return object_bounds.left <= bounds.left ||
+		object_bounds.top <= bounds.top ||
+		object_bounds.left + object_bounds.width >= bounds.left + bounds.width ||
+		object_bounds.top + object_bounds.height >= bounds.top + bounds.height;
+}
+
+template <typename NumberT>
+bool RemoveFromSummary(NodeSummary<NumberT>* summary, const BoundingBox<NumberT>& object_bounds) {
+	// true if the bounds went stale, that is when the object touched their edge
+	assert(summary->count > 0);
+	if (--summary->count == 0) {
+		summary->bounds = BoundingBox<NumberT>(0, 0, 0, 0);
+		summary->exact = true;
+		return false;
+	}
+	if (summary->exact && TouchesEdge(summary->bounds, object_bounds)) {
+		summary->exact = false;
+		return true;
+	}
+	return false;
+}
+
+template <typename NumberT, typename ObjectT>
 struct TreeNode {
+	using Number = NumberT;
 	using Object = ObjectT;
-	using ObjectContainer =
-		std::forward_list<Object*, BlocksAllocatorAdaptor<Object*>>;
+	using Record = ObjectRecord<Number, Object>;
 
-	TreeNode(BlocksAllocator& allocator) :
+	TreeNode() :
 		top_left(nullptr), top_right(nullptr), bottom_right(nullptr),
-		bottom_left(nullptr), objects(BlocksAllocatorAdaptor<Object*>(allocator))
+		bottom_left(nullptr), parent(nullptr), records(nullptr), summary(nullptr), size(0),
+		capacity(0), max_z_order(0)
 	{}
 
-	TreeNode<Object>* top_left;
-	TreeNode<Object>* top_right;
-	TreeNode<Object>* bottom_right;
-	TreeNode<Object>* bottom_left;
-	ObjectContainer objects;
+	TreeNode<Number, Object>* top_left;
+	TreeNode<Number, Object>* top_right;
+	TreeNode<Number, Object>* bottom_right;
+	TreeNode<Number, Object>* bottom_left;
+	TreeNode<Number, Object>* parent; ///< nullptr at the root
+	Record* records; ///< objects of the node in one array, in no particular order
+	NodeSummary<Number>* summary; ///< of the whole subtree, every node with children has one
+	int size; ///< records in use, including the ones removed while queries were open
+	int capacity;
+	unsigned long long max_z_order; ///< not below the z-order of anything in the subtree
+};
+
+template <typename NumberT, typename ObjectT>
+std::array<const TreeNode<NumberT, ObjectT>*, 4> ChildrenOf(const TreeNode<NumberT, ObjectT>* node) {
+	// in the order of ChildPosition, the same as QuarterBounds() gives their bounds
+	return {{node->top_left, node->top_right, node->bottom_right, node->bottom_left}};
+}
+
+template <typename NumberT, typename ObjectT, typename ObjectFitter, typename Visitor>
+bool VisitFittingRecords(const TreeNode<NumberT, ObjectT>* node, bool free_ride,
+		const ObjectFitter& object_fits, Visitor&& visitor) {
+	// the records are tested in place, a batch at once (see IntersectingMask()),
+	// an object is touched only when it's visited
+	if (free_ride) {
+		for (int r = 0; r < node->size; r++) {
+			ObjectT* object = node->records[r].object;
+			if (object != nullptr && !visitor(object)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	for (int first = 0; first < node->size; first += kMaskedBoxes) {
+		const ObjectRecord<NumberT, ObjectT>* records = node->records + first;
+		const int count = std::min(node->size - first, kMaskedBoxes);
+		for (unsigned long long fitting = FittingRecordsMask(records, count, object_fits);
+				fitting != 0; fitting &= fitting - 1) {
+			ObjectT* object = records[LowestBitIndex(fitting)].object;
+			if (object != nullptr && !visitor(object)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+template <typename NumberT, typename ObjectT>
+void AddRecordsToSummary(const TreeNode<NumberT, ObjectT>* node, NodeSummary<NumberT>* summary) {
+	for (int r = 0; r < node->size; r++) {
+		if (node->records[r].object != nullptr) {
+			AddToSummary(summary, node->records[r].bounds);
+		}
+	}
+}
+
+template <typename NumberT, typename ObjectT, typename ObjectFitter>
+void SummarizeFittingRecords(const TreeNode<NumberT, ObjectT>* node, bool free_ride,
+		const ObjectFitter& object_fits, NodeSummary<NumberT>* summary) {
+	// the records VisitFittingRecords() would visit, added to the summary
+	if (free_ride) {
+		AddRecordsToSummary(node, summary);
+		return;
+	}
+	for (int first = 0; first < node->size; first += kMaskedBoxes) {
+		const ObjectRecord<NumberT, ObjectT>* records = node->records + first;
+		const int count = std::min(node->size - first, kMaskedBoxes);
+		for (unsigned long long fitting = FittingRecordsMask(records, count, object_fits);
+				fitting != 0; fitting &= fitting - 1) {
+			const ObjectRecord<NumberT, ObjectT>& record = records[LowestBitIndex(fitting)];
+			if (record.object != nullptr) {
+				AddToSummary(summary, record.bounds);
+			}
+		}
+	}
+}
+
+
+
+template <typename ObjectT, typename ObjectHandleExtractorT>
+class ObjectHandleContainer {
+public:
+	using Object = ObjectT;
+	using ObjectHandleExtractor = ObjectHandleExtractorT;
+
+	ObjectHandleContainer(BlocksAllocator&) {}
+
+	ObjectHandle<Object>* Find(Object* object) const {
+		ObjectHandle<Object>* handle = ObjectHandleExtractor::ExtractObjectHandle(object);
+		return handle->slot != nullptr ? handle : nullptr;
+	}
+	ObjectHandle<Object>* Emplace(Object* object) {
+		ObjectHandle<Object>* handle = ObjectHandleExtractor::ExtractObjectHandle(object);
+		assert(handle->slot == nullptr);
+		return handle;
+	}
+	void Erase(Object* object) {
+		ObjectHandleExtractor::ExtractObjectHandle(object)->slot = nullptr;
+	}
+	void Reserve(std::size_t) {}
+	template <typename Record>
+	void ReleaseAll(const Record* records, int size) {
+		for (int i = 0; i < size; i++) {
+			if (records[i].object != nullptr) {
+				Erase(records[i].object);
+			}
+		}
+	}
+	void Clear() {}
+};
+
+
+
+template <typename ObjectT>
+class ObjectHandleContainer<ObjectT, void> {
+public:
+	using Object = ObjectT;
+
+	ObjectHandleContainer(BlocksAllocator& allocator) :
+		handles_(64, std::hash<Object*>(), std::equal_to<Object*>(),
+			BlocksAllocatorAdaptor<std::pair<Object *const, ObjectHandle<Object>>>(allocator)) {}
+
+	ObjectHandle<Object>* Find(Object* object) const {
+		auto it = handles_.find(object);
+		return it != handles_.end() ? const_cast<ObjectHandle<Object>*>(&it->second) : nullptr;
+	}
+	ObjectHandle<Object>* Emplace(Object* object) {
+		auto emplaced = handles_.emplace(object, ObjectHandle<Object>());
+		assert(emplaced.second);
+		return &emplaced.first->second;
+	}
+	void Erase(Object* object) {
+		handles_.erase(object);
+	}
+	void Reserve(std::size_t count) {
+		handles_.reserve(count);
+	}
+	template <typename Record>
+	void ReleaseAll(const Record*, int) {} ///< see Clear()
+	void Clear() {
+		handles_.clear();
+	}
+	std::size_t Size() const {
+		return handles_.size();
+	}
+
+private:
+	std::unordered_map<Object*, ObjectHandle<Object>,
+		std::hash<Object*>, std::equal_to<Object*>,
+		BlocksAllocatorAdaptor<std::pair<Object *const, ObjectHandle<Object>>>> handles_;
+};
+
+
+
+template <typename ObjectT, typename ZOrderExtractorT>
+struct ZOrderOf {
+	static unsigned long long Get(const ObjectT* object) {
+		return ZOrderExtractorT::ExtractZOrder(object);
+	}
+};
+
+template <typename ObjectT>
+struct ZOrderOf<ObjectT, void> {
+	static unsigned long long Get(const ObjectT*) {
+		return 0; ///< unordered, the summaries of the nodes stay zero
+	}
+};
+
+
+
+template <typename ObjectT>
+struct BulkInsertEntry {
+	using Object = ObjectT;
+
+	BulkInsertEntry() {}
+	BulkInsertEntry(Object* _object, ObjectHandle<Object>* _place) :
+		key(0), object(_object), place(_place) {}
+
+	unsigned long long key; ///< target node path in Morton order, then its depth
+	Object* object;
+	ObjectHandle<Object>* place; ///< to be filled in when the object is linked in
 };
 
 
 
+/// Stable LSD radix sort of bulk entries by the [first_bit, last_bit) bits of their keys
+template <typename ObjectT>
+void SortBulkInsertEntries(std::vector<BulkInsertEntry<ObjectT>>* entries,
+		int first_bit, int last_bit) {
+	constexpr int kRadixBits = 11;
+	constexpr std::size_t kRadixSize = std::size_t(1) << kRadixBits;
+	std::vector<BulkInsertEntry<ObjectT>> sorted(entries->size());
+	std::vector<std::size_t> offsets(kRadixSize);
+	for (int shift = first_bit; shift < last_bit; shift += kRadixBits) {
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (const auto& entry : *entries) {
+			offsets[(entry.key >> shift) & (kRadixSize - 1)]++;
+		}
+		std::size_t offset = 0;
+		for (std::size_t& bucket_offset : offsets) {
+			std::size_t bucket_size = bucket_offset;
+			bucket_offset = offset;
+			offset += bucket_size;
+		}
+		for (const auto& entry : *entries) {
+			sorted[offsets[(entry.key >> shift) & (kRadixSize - 1)]++] = entry;
+		}
+		entries->swap(sorted);
+	}
+}
+
+
+
 template <typename NumberT, typename ObjectT>
 class ForwardTreeTraversal {
 public:
@@ -345,20 +795,22 @@ public:
 	using Object = ObjectT;
 
 	struct TreePosition {
-		TreePosition(const BoundingBox<Number>& _bbox, TreeNode<Object>* _node) :
+		TreePosition() : bounding_box(0, 0, 0, 0), node(nullptr),
+			current_child(ChildPosition::kNone) {}
+		TreePosition(const BoundingBox<Number>& _bbox, TreeNode<Number, Object>* _node) :
 			bounding_box(_bbox), node(_node) {
 			current_child = ChildPosition::kNone;
 		}
 
 		BoundingBox<Number> bounding_box;
-		TreeNode<Object>* node;
+		TreeNode<Number, Object>* node;
 		ChildPosition current_child;
 	};
 
 	ForwardTreeTraversal();
-	void StartAt(TreeNode<Object>* root, const BoundingBox<Number>& root_bounds);
+	void StartAt(TreeNode<Number, Object>* root, const BoundingBox<Number>& root_bounds);
 	int GetDepth() const; ///< starting from 0
-	TreeNode<Object>* GetNode() const;
+	TreeNode<Number, Object>* GetNode() const;
 	const BoundingBox<Number>& GetNodeBoundingBox() const;
 	void GoTopLeft();
 	void GoTopRight();
@@ -378,8 +830,9 @@ public:
 	using Number = NumberT;
 	using Object = ObjectT;
 	using typename ForwardTreeTraversal<Number, Object>::TreePosition;
+	constexpr static int kMaxDepth = (sizeof(long long) * 8 - 1) / 2; ///< of the nodes in a tree
 
-	void StartAt(TreeNode<Object>* root, const BoundingBox<Number>& root_bounds);
+	void StartAt(TreeNode<Number, Object>* root, const BoundingBox<Number>& root_bounds);
 	ChildPosition GetNodeCurrentChild() const;
 	void SetNodeCurrentChild(ChildPosition child_position);
 	void GoUp();
@@ -392,7 +845,7 @@ private:
 	using ForwardTreeTraversal<Number, Object>::position_;
 	using ForwardTreeTraversal<Number, Object>::depth_;
 
-	std::vector<TreePosition> position_stack_;
+	std::array<TreePosition, kMaxDepth> position_stack_; ///< the parents, no allocation
 };
 
 
@@ -401,17 +854,20 @@ private:
 
 
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 class
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::
 Impl {
 public:
 	enum class QueryType {kIntersects, kInside, kContains, kEndOfQuery};
 
 	Impl();
-	void Acquire(typename LooseQuadtree<Number, Object, BoundingBoxExtractor>::Impl* quadtree,
+	void Acquire(const typename LooseQuadtree<Number, Object, BoundingBoxExtractor,
+			ObjectHandleExtractor, ZOrderExtractor>::Impl* quadtree,
 		const BoundingBox<Number>* query_region, QueryType query_type);
 	void Release();
+	void TakeOver(Impl* other); ///< the state of other, which becomes available
 	bool IsAvailable() const;
 	bool EndOfQuery() const;
 	Object* GetCurrent() const;
@@ -423,10 +879,10 @@ private:
 	bool CurrentObjectFits() const;
 	FitType CurrentNodeFits() const;
 
-	typename LooseQuadtree<Number, Object, BoundingBoxExtractor>::Impl* quadtree_;
+	const typename LooseQuadtree<Number, Object, BoundingBoxExtractor,
+		ObjectHandleExtractor, ZOrderExtractor>::Impl* quadtree_; ///< only read
 	detail::FullTreeTraversal<Number, Object> traversal_;
-	typename detail::TreeNode<Object>::ObjectContainer::iterator object_iterator_;
-	typename detail::TreeNode<Object>::ObjectContainer::iterator object_iterator_before_;
+	int object_index_; ///< in the records of the current node, -1 before the first one
 	BoundingBox<Number> query_region_;
 	QueryType query_type_;
 	int free_ride_from_level_;
@@ -434,13 +890,17 @@ private:
 
 
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 class
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
 Impl {
 public:
 	constexpr static int kInternalMinDepth = 4;
 	constexpr static int kInternalMaxDepth = (sizeof(long long) * 8 - 1) / 2;
+	constexpr static int kNodeKeyMaxDepth = 23; ///< deeper nodes have no key
+	constexpr static int kPartSplitMaxDepth = 6; ///< ForEachIntersectingPart() splits above it
+	constexpr static int kPartSubtreesPerPart = 4; ///< so a heavy subtree doesn't keep one busy
 	constexpr static Number kMinimalObjectExtent =
 		std::is_integral<Number>::value ? 1 :
 			std::numeric_limits<Number>::min() * 16;
@@ -451,40 +911,140 @@ public:
 	Impl& operator=(const Impl&) = delete;
 
 	bool Insert(Object* object);
+	template <typename ForwardIterator>
+	void InsertBulk(ForwardIterator first, ForwardIterator last);
 	bool Update(Object* object);
+	template <typename ForwardIterator>
+	void UpdateBulk(ForwardIterator first, ForwardIterator last);
 	bool Remove(Object* object);
 	bool Contains(Object* object) const;
-	Query QueryIntersectsRegion(const BoundingBox<Number>& region);
-	Query QueryInsideRegion(const BoundingBox<Number>& region);
-	Query QueryContainsRegion(const BoundingBox<Number>& region);
+	Query QueryIntersectsRegion(const BoundingBox<Number>& region) const;
+	Query QueryInsideRegion(const BoundingBox<Number>& region) const;
+	Query QueryContainsRegion(const BoundingBox<Number>& region) const;
+	template <typename Visitor>
+	bool ForEachIntersecting(const BoundingBox<Number>& region, Visitor&& visitor) const;
+	template <typename Visitor>
+	bool ForEachContainingPoint(Number x, Number y, Visitor&& visitor) const;
+	template <typename Visitor>
+	bool ForEachIntersectingMany(const BoundingBox<Number>* regions, int count,
+		Visitor&& visitor) const;
+	template <typename Visitor>
+	bool ForEachIntersectingPart(const BoundingBox<Number>& region, int part, int part_count,
+		Visitor&& visitor) const;
+	template <typename Visitor, typename SummaryVisitor>
+	bool ForEachIntersectingCoarse(const BoundingBox<Number>& region, Number min_node_size,
+		Visitor&& visitor, SummaryVisitor&& summary_visitor) const;
+	Object* FindTopmostContainingPoint(Number x, Number y) const;
+	template <typename Visitor>
+	bool ForEachNearest(Number x, Number y, Number max_distance, Visitor&& visitor) const;
+	template <typename Visitor>
+	bool ForEachOnSegment(Number x1, Number y1, Number x2, Number y2, Visitor&& visitor) const;
+	template <typename Visitor>
+	void ForEachNode(const BoundingBox<Number>& region, Visitor&& visitor) const;
+	Statistics GetStatistics() const;
+	int CountIntersecting(const BoundingBox<Number>& region) const;
+	bool GetIntersectingBounds(const BoundingBox<Number>& region,
+		BoundingBox<Number>* bounds) const;
 	const BoundingBox<Number>& GetBoundingBox() const; ///< loose sense bounds
 	int GetSize() const;
+	long long GetInPlaceUpdateCount() const;
+	long long GetRelinkingUpdateCount() const;
+	void ResetUpdateCounters();
 	void Clear();
 	void ForceCleanup();
+	bool CleanupStep(int max_objects);
+	bool NeedsCleanup() const;
+	int GetRemovedCount() const;
 
 private:
 	friend class Query::Impl;
-	using ObjectPointerContainer =
-		std::unordered_map<Object*, Object**,
-		std::hash<Object*>, std::equal_to<Object*>,
-		detail::BlocksAllocatorAdaptor<std::pair<Object *const, Object**>>>;
-	using QueryPoolContainer =
-		std::deque<typename LooseQuadtree<Number, Object, BoundingBoxExtractor>::Query::Impl>;
+	using ObjectHandleContainer =
+		detail::ObjectHandleContainer<Object, ObjectHandleExtractor>;
+	using ZOrderOf = detail::ZOrderOf<Object, ZOrderExtractor>;
+	struct BestFirstEntry {
+		double key; ///< from the ranker of VisitBestFirst(), the lowest goes first
+		int depth; ///< of the node, the objects count as deeper than any node
+		const detail::TreeNode<Number, Object>* node; ///< nullptr if this is an object
+		Object* object;
+		BoundingBox<Number> node_bounds;
+	};
+	struct BestFirstEntryGoesLater {
+		bool operator()(const BestFirstEntry& a, const BestFirstEntry& b) const {
+			// on a tie the objects and then the deeper nodes go first, as the
+			// points inside of the objects are all at zero distance to a lot of nodes
+			return a.key > b.key || (a.key == b.key && a.depth < b.depth);
+		}
+	};
+	static_assert(kInternalMaxDepth <= detail::FullTreeTraversal<Number, Object>::kMaxDepth,
+		"the traversals can't reach the deepest nodes");
 
+	static void GetObjectPlacement(const BoundingBox<Number>& object_bounds,
+		Number* center_x, Number* center_y, Number* maximal_extent);
 	void RecalculateMaximalDepth();
 	void DeleteTree();
-	Object** InsertIntoTree(Object* object);
-	typename Query::Impl* GetAvailableQueryFromPool();
+	void CreateRoot(Number object_center_x, Number object_center_y,
+		Number maximal_object_extent);
+	void GrowRoot(Number object_center_x, Number object_center_y,
+		Number maximal_object_extent);
+	int GetTargetPath(Number object_center_x, Number object_center_y,
+		Number maximal_object_extent, unsigned long long* path) const;
+	unsigned long long MakeNodeKey(unsigned long long path, int depth) const;
+	Object** InsertIntoNode(detail::TreeNode<Number, Object>* node, Object* object,
+		const BoundingBox<Number>& object_bounds);
+	void MakeRoomInNode(detail::TreeNode<Number, Object>* node);
+	void ReserveInNode(detail::TreeNode<Number, Object>* node, int capacity);
+	void MoveRecords(detail::TreeNode<Number, Object>* node, int capacity);
+	void CompactNode(detail::TreeNode<Number, Object>* node);
+	void ReleaseRecords(detail::TreeNode<Number, Object>* node);
+	void UnlinkRecord(ObjectHandle<Object>* place);
+	int TidyNode(detail::TreeNode<Number, Object>* node, int depth);
+	static void RaiseZOrder(detail::TreeNode<Number, Object>* node, unsigned long long z_order);
+	void InsertIntoTree(Object* object, const BoundingBox<Number>& object_bounds,
+		ObjectHandle<Object>* place);
+	void UpdatePlace(Object* object, ObjectHandle<Object>* place);
+	template <typename NodeFitter, typename ObjectFitter, typename Visitor>
+	bool VisitFitting(NodeFitter&& node_fits, ObjectFitter&& object_fits, Visitor&& visitor) const;
+	template <typename NodeFitter, typename ObjectFitter, typename Visitor>
+	bool VisitFittingFrom(const detail::TreeNode<Number, Object>* start,
+		const BoundingBox<Number>& start_bounds, bool start_free_ride,
+		NodeFitter&& node_fits, ObjectFitter&& object_fits, Visitor&& visitor) const;
+	template <typename NodeFitter, typename NodeVisitor>
+	bool WalkFittingFrom(const detail::TreeNode<Number, Object>* start,
+		const BoundingBox<Number>& start_bounds, bool start_free_ride,
+		NodeFitter&& node_fits, NodeVisitor&& node_visitor) const;
+	template <typename Ranker, typename Visitor>
+	bool VisitBestFirst(Ranker&& rank, Visitor&& visitor) const;
+	template <typename Visitor>
+	void VisitNodes(const BoundingBox<Number>* region, Visitor&& visitor) const;
+	int SummarizeIntersecting(const BoundingBox<Number>& region,
+		BoundingBox<Number>* bounds) const;
+	void RecalculateSummary(detail::TreeNode<Number, Object>* node);
+	void RemoveFromSummaries(detail::TreeNode<Number, Object>* node,
+		const BoundingBox<Number>& object_bounds);
+	void MoveInSummaries(detail::TreeNode<Number, Object>* node,
+		const BoundingBox<Number>& old_bounds, const BoundingBox<Number>& new_bounds);
+	void ReleaseSummary(detail::TreeNode<Number, Object>* node);
+	void DeleteNode(detail::TreeNode<Number, Object>* node);
+	bool ContinueCleanupPass(int max_records);
+	void AbandonCleanup();
 
 	detail::BlocksAllocator allocator_;
-	detail::TreeNode<Object>* root_;
+	detail::TreeNode<Number, Object>* root_;
 	BoundingBox<Number> bounding_box_;
-	ObjectPointerContainer object_pointers_;
+	int root_growths_; ///< times the root got a new parent since it was created
+	ObjectHandleContainer object_handles_;
 	int number_of_objects_;
+	int removed_records_; ///< records of objects removed while queries were open, until a cleanup
+	int untidy_nodes_; ///< nodes left empty, mostly empty or too deep by removals (an estimate)
 	int maximal_depth_;
+	long long in_place_updates_;
+	long long relinking_updates_;
 	detail::FullTreeTraversal<Number, Object> internal_traversal_;
-	QueryPoolContainer query_pool_;
-	int running_queries_; ///< queries which are opened and not at their end
+	mutable std::atomic<int> running_queries_; ///< queries which are opened and not at their end
+	detail::FullTreeTraversal<Number, Object> cleanup_traversal_; ///< the pass of CleanupStep()
+	const detail::TreeNode<Number, Object>* cleanup_root_; ///< when the pass started, or nullptr
+	int cleanup_untidy_nodes_; ///< untidy_nodes_ when the pass started, it tidies those up
+	std::size_t cleanup_size_class_; ///< whose free blocks the next CleanupStep() releases
 };
 
 
@@ -529,7 +1089,7 @@ ForwardTreeTraversal() :
 template <typename NumberT, typename ObjectT>
 void
 	detail::ForwardTreeTraversal<NumberT, ObjectT>::
-StartAt(TreeNode<Object>* root, const BoundingBox<Number>& root_bounds) {
+StartAt(TreeNode<Number, Object>* root, const BoundingBox<Number>& root_bounds) {
 	position_.bounding_box = root_bounds;
 	position_.node = root;
 	depth_ = 0;
@@ -543,7 +1103,7 @@ GetDepth() const {
 }
 
 template <typename NumberT, typename ObjectT>
-detail::TreeNode<ObjectT>*
+detail::TreeNode<NumberT, ObjectT>*
 	detail::ForwardTreeTraversal<NumberT, ObjectT>::
 GetNode() const {
 	return position_.node;
@@ -621,10 +1181,9 @@ GoBottomLeft() {
 template <typename NumberT, typename ObjectT>
 void
 	detail::FullTreeTraversal<NumberT, ObjectT>::
-StartAt(TreeNode<Object>* root, const BoundingBox<Number>& root_bounds) {
+StartAt(TreeNode<Number, Object>* root, const BoundingBox<Number>& root_bounds) {
 	ForwardTreeTraversal<Number, Object>::StartAt(root, root_bounds);
 	position_.current_child = ChildPosition::kNone;
-	position_stack_.clear();
 }
 
 template <typename NumberT, typename ObjectT>
@@ -645,9 +1204,9 @@ template <typename NumberT, typename ObjectT>
 void
 	detail::FullTreeTraversal<NumberT, ObjectT>::
 GoTopLeft() {
-	assert((size_t)depth_ == position_stack_.size());
+	assert(depth_ < kMaxDepth);
 	position_.current_child = ChildPosition::kTopLeft;
-	position_stack_.emplace_back(position_);
+	position_stack_[depth_] = position_;
 	ForwardTreeTraversal<Number, Object>::GoTopLeft();
 	position_.current_child = ChildPosition::kNone;
 }
@@ -656,9 +1215,9 @@ template <typename NumberT, typename ObjectT>
 void
 	detail::FullTreeTraversal<NumberT, ObjectT>::
 GoTopRight() {
-	assert((size_t)depth_ == position_stack_.size());
+	assert(depth_ < kMaxDepth);
 	position_.current_child = ChildPosition::kTopRight;
-	position_stack_.emplace_back(position_);
+	position_stack_[depth_] = position_;
 	ForwardTreeTraversal<Number, Object>::GoTopRight();
 	position_.current_child = ChildPosition::kNone;
 }
@@ -667,9 +1226,9 @@ template <typename NumberT, typename ObjectT>
 void
 	detail::FullTreeTraversal<NumberT, ObjectT>::
 GoBottomRight() {
-	assert((size_t)depth_ == position_stack_.size());
+	assert(depth_ < kMaxDepth);
 	position_.current_child = ChildPosition::kBottomRight;
-	position_stack_.emplace_back(position_);
+	position_stack_[depth_] = position_;
 	ForwardTreeTraversal<Number, Object>::GoBottomRight();
 	position_.current_child = ChildPosition::kNone;
 }
@@ -678,9 +1237,9 @@ template <typename NumberT, typename ObjectT>
 void
 	detail::FullTreeTraversal<NumberT, ObjectT>::
 GoBottomLeft() {
-	assert((size_t)depth_ == position_stack_.size());
+	assert(depth_ < kMaxDepth);
 	position_.current_child = ChildPosition::kBottomLeft;
-	position_stack_.emplace_back(position_);
+	position_stack_[depth_] = position_;
 	ForwardTreeTraversal<Number, Object>::GoBottomLeft();
 	position_.current_child = ChildPosition::kNone;
 }
@@ -689,25 +1248,28 @@ template <typename NumberT, typename ObjectT>
 void
 	detail::FullTreeTraversal<NumberT, ObjectT>::
 GoUp() {
-	assert((size_t)depth_ == position_stack_.size() && depth_ > 0);
-	position_ = position_stack_.back();
+	assert(depth_ > 0);
 	depth_--;
-	position_stack_.pop_back();
+	position_ = position_stack_[depth_];
 }
 
 
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::Impl::
-Impl() : quadtree_(nullptr), query_region_(0,0,0,0),
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::Impl::
+Impl() : quadtree_(nullptr), object_index_(-1), query_region_(0,0,0,0),
 	query_type_(QueryType::kEndOfQuery),
-	free_ride_from_level_(LooseQuadtree<Number, Object, BoundingBoxExtractor>::Impl::kInternalMaxDepth) {
+	free_ride_from_level_(LooseQuadtree<Number, Object, BoundingBoxExtractor,
+		ObjectHandleExtractor, ZOrderExtractor>::Impl::kInternalMaxDepth) {
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 void
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::Impl::
-Acquire(typename LooseQuadtree<Number, Object, BoundingBoxExtractor>::Impl* quadtree,
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::Impl::
+Acquire(const typename LooseQuadtree<Number, Object, BoundingBoxExtractor,
+			ObjectHandleExtractor, ZOrderExtractor>::Impl* quadtree,
 		const BoundingBox<Number>* query_region, QueryType query_type) {
 	assert(IsAvailable());
 	assert(query_type != QueryType::kEndOfQuery);
@@ -715,61 +1277,83 @@ Acquire(typename LooseQuadtree<Number, Object, BoundingBoxExtractor>::Impl* quad
 	query_region_ = *query_region;
 	query_type_ = query_type;
 	free_ride_from_level_ =
-		LooseQuadtree<Number, Object, BoundingBoxExtractor>::Impl::kInternalMaxDepth;
+		LooseQuadtree<Number, Object, BoundingBoxExtractor,
+			ObjectHandleExtractor, ZOrderExtractor>::Impl::kInternalMaxDepth;
 	if (quadtree->root_ == nullptr) {
 		query_type_ = QueryType::kEndOfQuery;
 	}
 	else {
 		quadtree_->running_queries_++;
 		traversal_.StartAt(quadtree->root_, quadtree->bounding_box_);
-		object_iterator_ = traversal_.GetNode()->objects.before_begin();
+		object_index_ = -1;
 		Next();
 	}
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 void
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::Impl::
 Release() {
 	assert(!IsAvailable());
+	// left before its end, it doesn't hold back the cleanup of the others anymore
+	if (query_type_ != QueryType::kEndOfQuery) {
+		quadtree_->running_queries_--;
+		query_type_ = QueryType::kEndOfQuery;
+	}
 	quadtree_ = nullptr;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::Impl::
+TakeOver(Impl* other) {
+	assert(IsAvailable());
+	// a running query stays counted once, by its new owner
+	*this = *other;
+	other->quadtree_ = nullptr;
+	other->query_type_ = QueryType::kEndOfQuery;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::Impl::
 IsAvailable() const {
 	return quadtree_ == nullptr;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::Impl::
 EndOfQuery() const {
 	assert(!IsAvailable());
 	return query_type_ == QueryType::kEndOfQuery;
 }
 
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 ObjectT*
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::Impl::
 GetCurrent() const {
 	assert(!IsAvailable());
 	assert(!EndOfQuery());
-	return *object_iterator_;
+	return traversal_.GetNode()->records[object_index_].object;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 void
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::Impl::
 Next() {
 	assert(!IsAvailable());
 	assert(!EndOfQuery());
 	do {
-		object_iterator_before_ = object_iterator_;
-		object_iterator_++;
-		if (object_iterator_ == traversal_.GetNode()->objects.end()) {
+		object_index_++;
+		if (object_index_ >= traversal_.GetNode()->size) {
 			do {
 				switch (traversal_.GetNodeCurrentChild()) {
 				case detail::ChildPosition::kNone:
@@ -809,83 +1393,18 @@ Next() {
 					}
 					break;
 				case detail::ChildPosition::kBottomLeft:
-
-#ifndef NDEBUG
-					int running_queries = 0;
-					for (auto& query : quadtree_->query_pool_) {
-						if (!query.IsAvailable() && !query.EndOfQuery()) running_queries++;
-					}
-					assert(running_queries == quadtree_->running_queries_);
-#endif
-
-					//only run this if no parallel queries are running
-					if (traversal_.GetDepth() > quadtree_->maximal_depth_ &&
-							quadtree_->running_queries_ == 1) {
-						typename detail::TreeNode<Object>::ObjectContainer& objects =
-								traversal_.GetNode()->objects;
-						auto iterator = objects.begin();
-						while (iterator != objects.end()) {
-							if (*iterator != nullptr) {
-								quadtree_->Update(*iterator);
-								assert(*iterator == nullptr);
-							}
-							iterator++;
-						}
-						objects.clear();
-					}
-
+					assert(quadtree_->running_queries_ > 0);
+					// the tree is only read, its cleanup is done by CleanupStep() and ForceCleanup()
 					if (traversal_.GetDepth() > 0) {
-						bool remove_node = (traversal_.GetNode()->objects.empty() &&
-								traversal_.GetNode()->top_left == nullptr &&
-								traversal_.GetNode()->top_right == nullptr &&
-								traversal_.GetNode()->bottom_right == nullptr &&
-								traversal_.GetNode()->bottom_left == nullptr);
-						detail::TreeNode<Object>* node = traversal_.GetNode();
 						traversal_.GoUp();
-
-						// if the node is empty no other queries can be invalidated by deleting
-						if (remove_node) {
-							switch (traversal_.GetNodeCurrentChild()) {
-							case detail::ChildPosition::kTopLeft:
-								traversal_.GetNode()->top_left = nullptr;
-								break;
-							case detail::ChildPosition::kTopRight:
-								traversal_.GetNode()->top_right = nullptr;
-								break;
-							case detail::ChildPosition::kBottomRight:
-								traversal_.GetNode()->bottom_right = nullptr;
-								break;
-							case detail::ChildPosition::kBottomLeft:
-								traversal_.GetNode()->bottom_left = nullptr;
-								break;
-							case detail::ChildPosition::kNone:
-								assert(false);
-							}
-							quadtree_->allocator_.Delete(node);
-						}
-
 						if (free_ride_from_level_ == traversal_.GetDepth() + 1) {
 							free_ride_from_level_ =
-								LooseQuadtree<Number, Object,
-									BoundingBoxExtractor>::Impl::kInternalMaxDepth;
+								LooseQuadtree<Number, Object, BoundingBoxExtractor,
+									ObjectHandleExtractor, ZOrderExtractor>::Impl::kInternalMaxDepth;
 						}
 						continue;
 					}
 					else {
-						// if the root is empty no other queries can be invalidated by deleting
-						if (traversal_.GetNode()->objects.empty() &&
-								traversal_.GetNode()->top_left == nullptr &&
-								traversal_.GetNode()->top_right == nullptr &&
-								traversal_.GetNode()->bottom_right == nullptr &&
-								traversal_.GetNode()->bottom_left == nullptr) {
-							assert(traversal_.GetNode() == quadtree_->root_);
-							assert(quadtree_->GetSize() == 0);
-							assert(quadtree_->object_pointers_.size() == 0);
-							quadtree_->allocator_.Delete(quadtree_->root_);
-							quadtree_->root_ = nullptr;
-							quadtree_->bounding_box_ = BoundingBox<Number>(0,0,0,0);
-						}
-
 						quadtree_->running_queries_--;
 						query_type_ = QueryType::kEndOfQuery;
 						return;
@@ -906,31 +1425,26 @@ Next() {
 						continue;
 					}
 				}
-				object_iterator_ = traversal_.GetNode()->objects.before_begin();
+				object_index_ = -1;
 				break;
 			} while (true);
 		}
-		else if (*object_iterator_ == nullptr) {
-			// other queries also cannot stop on an empty object,
-			// so we are not invalidating any iterators/queries with this
-			traversal_.GetNode()->objects.erase_after(object_iterator_before_);
-			object_iterator_ = object_iterator_before_;
-		}
-		else {
-			if (traversal_.GetDepth() >= free_ride_from_level_ ||
-					CurrentObjectFits()) {
-				break;
-			}
+		else if (traversal_.GetNode()->records[object_index_].object != nullptr &&
+				(traversal_.GetDepth() >= free_ride_from_level_ || CurrentObjectFits())) {
+			break; // the removed ones are skipped
 		}
 	} while (true);
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::Impl::
 CurrentObjectFits() const {
-	BoundingBox<Number> object_bounds(0,0,0,0);
-	BoundingBoxExtractor::ExtractBoundingBox(GetCurrent(), &object_bounds);
+	assert(!IsAvailable());
+	assert(!EndOfQuery());
+	const BoundingBox<Number>& object_bounds =
+		traversal_.GetNode()->records[object_index_].bounds;
 	switch (query_type_) {
 	case QueryType::kIntersects:
 		return query_region_.Intersects(object_bounds);
@@ -944,9 +1458,10 @@ CurrentObjectFits() const {
 	return false;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 auto
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::Impl::
 CurrentNodeFits() const -> FitType {
 	const BoundingBox<Number>& node_bounds = traversal_.GetNodeBoundingBox();
 	BoundingBox<Number> extended_bounds = node_bounds;
@@ -988,130 +1503,1160 @@ CurrentNodeFits() const -> FitType {
 
 
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
 Impl() :
-	root_(nullptr), bounding_box_(0, 0, 0, 0),
-	object_pointers_(64, std::hash<Object*>(), std::equal_to<Object*>(),
-		detail::BlocksAllocatorAdaptor<std::pair<const Object*, Object**>>(allocator_)),
-	number_of_objects_(0), maximal_depth_(kInternalMinDepth),
-	running_queries_(0) {
+	root_(nullptr), bounding_box_(0, 0, 0, 0), root_growths_(0),
+	object_handles_(allocator_),
+	number_of_objects_(0), removed_records_(0), untidy_nodes_(0), maximal_depth_(kInternalMinDepth),
+	in_place_updates_(0), relinking_updates_(0),
+	running_queries_(0), cleanup_root_(nullptr), cleanup_untidy_nodes_(0),
+	cleanup_size_class_(detail::BlocksAllocator::kSizeClasses) {
 	assert(maximal_depth_ < kInternalMaxDepth);
-	//object_pointers_.reserve(64);
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
 ~Impl() {
 	DeleteTree();
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
 Insert(Object* object) {
 	bool was_removed = Remove(object);
-	Object** place = InsertIntoTree(object);
-	object_pointers_.emplace(object, place);
+	BoundingBox<Number> object_bounds(0, 0, 0, 0);
+	BoundingBoxExtractor::ExtractBoundingBox(object, &object_bounds);
+	InsertIntoTree(object, object_bounds, object_handles_.Emplace(object));
 	number_of_objects_++;
 	RecalculateMaximalDepth();
 	return !was_removed;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
-Update(Object* object) {
-	return !Insert(object);
-}
-
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
-Remove(Object* object) {
-	auto it = object_pointers_.find(object);
-	if (it != object_pointers_.end()) {
-		assert(*(it->second) == it->first);
-		*(it->second) = nullptr;
-		object_pointers_.erase(it);
-		number_of_objects_--;
-		RecalculateMaximalDepth();
-		return true;
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename ForwardIterator>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+InsertBulk(ForwardIterator first, ForwardIterator last) {
+	struct Placement {
+		Number center_x;
+		Number center_y;
+		Number maximal_extent;
+	};
+	std::size_t count = (std::size_t)std::distance(first, last);
+	std::vector<detail::BulkInsertEntry<Object>> entries;
+	std::vector<Placement> placements;
+	entries.reserve(count);
+	placements.reserve(count);
+	object_handles_.Reserve((std::size_t)number_of_objects_ + count);
+
+	// registered in the given order (which is usually the allocation order too),
+	// the final slots are filled in when the objects are linked into the nodes
+	for (; first != last; first++) {
+		Object* object = *first;
+		ObjectHandle<Object>* place = object_handles_.Find(object);
+		if (place == nullptr) {
+			place = object_handles_.Emplace(object);
+		}
+		else if (place->slot == nullptr) {
+			continue; // listed twice in the range
+		}
+		else {
+			// was already in the tree, the old place is released like in Insert()
+			assert(*place->slot == object);
+			UnlinkRecord(place);
+			place->slot = nullptr;
+			number_of_objects_--;
+		}
+		entries.emplace_back(object, place);
+
+		Placement placement;
+		BoundingBox<Number> object_bounds(0, 0, 0, 0);
+		BoundingBoxExtractor::ExtractBoundingBox(object, &object_bounds);
+		GetObjectPlacement(object_bounds, &placement.center_x, &placement.center_y,
+			&placement.maximal_extent);
+		if (root_ == nullptr) {
+			CreateRoot(placement.center_x, placement.center_y, placement.maximal_extent);
+		}
+		else {
+			GrowRoot(placement.center_x, placement.center_y, placement.maximal_extent);
+		}
+		placements.push_back(placement);
 	}
-	return false;
-}
-
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
-Contains(Object* object) const {
-	return object_pointers_.find(object) != object_pointers_.end();
-}
-
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-auto
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
-QueryIntersectsRegion(const BoundingBox<Number>& region) -> Query {
-	typename Query::Impl* query_impl = GetAvailableQueryFromPool();
-	query_impl->Acquire(this, &region, Query::Impl::QueryType::kIntersects);
-	return Query(query_impl);
-}
+	if (entries.empty()) {
+		return;
+	}
+	long long objects_before = number_of_objects_;
+	int depth_limit = maximal_depth_;
+	number_of_objects_ += (int)entries.size();
+	RecalculateMaximalDepth();
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-auto
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
-QueryInsideRegion(const BoundingBox<Number>& region) -> Query {
-	typename Query::Impl* query_impl = GetAvailableQueryFromPool();
-	query_impl->Acquire(this, &region, Query::Impl::QueryType::kInside);
-	return Query(query_impl);
+	// the bounds and the depth are final now, so is the target node of every object
+	constexpr int kDepthBits = 6;
+	static_assert(kInternalMaxDepth < (1 << kDepthBits), "depth doesn't fit into the key");
+	// the object count is an int, so the maximal depth stays far below that limit
+	const int path_depth = maximal_depth_;
+	assert(2 * path_depth + kDepthBits <= 64);
+	for (std::size_t i = 0; i < entries.size(); i++) {
+		unsigned long long path;
+		int depth = GetTargetPath(placements[i].center_x, placements[i].center_y,
+			placements[i].maximal_extent, &path);
+		// as deep as Insert() would put it in the given order, the maximal depth grows
+		// with the count on the way; the final depth would double the nodes of a grid
+		while (depth_limit < path_depth &&
+				objects_before + (long long)i > 1ll << (depth_limit << 1)) {
+			depth_limit++;
+		}
+		if (depth > depth_limit) {
+			path >>= 2 * (depth - depth_limit);
+			depth = depth_limit;
+		}
+		entries[i].key = path << (2 * (path_depth - depth) + kDepthBits) |
+			(unsigned long long)depth;
+	}
+	placements = std::vector<Placement>();
+	// the depth is sorted too, so the objects of a node end up next to each other
+	// and the records of the node are allocated once for all of them
+	detail::SortBulkInsertEntries(&entries, 0, kDepthBits + 2 * path_depth);
+
+	// neighbours in Morton order share most of their path, so only the
+	// differing tail of it is walked (and created) for every object
+	std::array<detail::TreeNode<Number, Object>*, kInternalMaxDepth + 1> path_nodes;
+	path_nodes[0] = root_;
+	// the summaries and z-orders of the path are raised when a node leaves it, by
+	// everything added below it meanwhile, rather than level by level for every object
+	struct PathUpkeep {
+		detail::NodeSummary<Number> summary;
+		unsigned long long max_z_order = 0;
+	};
+	std::array<PathUpkeep, kInternalMaxDepth + 1> path_upkeep;
+	auto leave_path = [this, &path_nodes, &path_upkeep](int depth) {
+		PathUpkeep& upkeep = path_upkeep[depth];
+		RaiseZOrder(path_nodes[depth], upkeep.max_z_order);
+		if (path_nodes[depth]->summary != nullptr) {
+			detail::MergeSummaries(path_nodes[depth]->summary, upkeep.summary);
+		}
+		if (depth > 0) {
+			detail::MergeSummaries(&path_upkeep[depth - 1].summary, upkeep.summary);
+			path_upkeep[depth - 1].max_z_order =
+				std::max(path_upkeep[depth - 1].max_z_order, upkeep.max_z_order);
+		}
+		upkeep = PathUpkeep();
+	};
+	int valid_depth = 0;
+	unsigned long long previous_key = 0;
+	const int top_digit_shift = kDepthBits + 2 * (path_depth - 1);
+	int duplicates = 0;
+	for (std::size_t i = 0; i < entries.size(); i++) {
+		auto& entry = entries[i];
+		if (entry.place->slot != nullptr) {
+			// listed twice, unused handles inside of the objects can't tell it earlier
+			duplicates++;
+			continue;
+		}
+		int entry_depth = (int)(entry.key & ((1u << kDepthBits) - 1));
+		int depth = 0;
+		int shift = top_digit_shift;
+		while (depth < valid_depth && depth < entry_depth &&
+				((entry.key ^ previous_key) >> shift & 3) == 0) {
+			depth++;
+			shift -= 2;
+		}
+		for (int level = valid_depth; level > depth; level--) {
+			leave_path(level);
+		}
+		for (; depth < entry_depth; depth++, shift -= 2) {
+			detail::TreeNode<Number, Object>** direction;
+			switch (entry.key >> shift & 3) {
+			case 0:
+				direction = &path_nodes[depth]->top_left;
+				break;
+			case 1:
+				direction = &path_nodes[depth]->top_right;
+				break;
+			case 2:
+				direction = &path_nodes[depth]->bottom_left;
+				break;
+			default:
+				direction = &path_nodes[depth]->bottom_right;
+				break;
+			}
+			if (*direction == nullptr) {
+				*direction = allocator_.New<detail::TreeNode<Number, Object>>();
+				(*direction)->parent = path_nodes[depth];
+				if (path_nodes[depth]->summary == nullptr) {
+					// its records are all in the new summary, the ones still waiting
+					// for it are only for the nodes above
+					RecalculateSummary(path_nodes[depth]);
+					if (depth > 0) {
+						detail::MergeSummaries(&path_upkeep[depth - 1].summary,
+							path_upkeep[depth].summary);
+					}
+					path_upkeep[depth].summary = detail::NodeSummary<Number>();
+				}
+			}
+			path_nodes[depth + 1] = *direction;
+		}
+		if (i == 0 || entries[i - 1].key != entry.key) {
+			std::size_t run = i + 1;
+			while (run < entries.size() && entries[run].key == entry.key) {
+				run++;
+			}
+			detail::TreeNode<Number, Object>* node = path_nodes[entry_depth];
+			ReserveInNode(node, node->size + (int)(run - i));
+		}
+		valid_depth = entry_depth;
+		previous_key = entry.key;
+		// taken from the object again, rather than sorted along with the entries
+		BoundingBox<Number> object_bounds(0, 0, 0, 0);
+		BoundingBoxExtractor::ExtractBoundingBox(entry.object, &object_bounds);
+		PathUpkeep& upkeep = path_upkeep[entry_depth];
+		detail::AddToSummary(&upkeep.summary, object_bounds);
+		upkeep.max_z_order = std::max(upkeep.max_z_order, ZOrderOf::Get(entry.object));
+		entry.place->slot = InsertIntoNode(path_nodes[entry_depth], entry.object, object_bounds);
+		entry.place->node = path_nodes[entry_depth];
+		entry.place->node_key = MakeNodeKey(
+			entry.key >> (2 * (path_depth - entry_depth) + kDepthBits), entry_depth);
+	}
+	for (int level = valid_depth; level >= 0; level--) {
+		leave_path(level);
+	}
+	if (duplicates > 0) {
+		number_of_objects_ -= duplicates;
+		RecalculateMaximalDepth();
+	}
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+Update(Object* object) {
+	ObjectHandle<Object>* place = object_handles_.Find(object);
+	if (place == nullptr) {
+		return !Insert(object);
+	}
+	UpdatePlace(object, place);
+	return true;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename ForwardIterator>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+UpdateBulk(ForwardIterator first, ForwardIterator last) {
+	// the known objects can't change the size of the tree, only the unknown
+	// ones have to be inserted (and the maximal depth recalculated) at the end
+	std::vector<Object*> missing_objects;
+	for (; first != last; ++first) {
+		Object* object = *first;
+		ObjectHandle<Object>* place = object_handles_.Find(object);
+		if (place == nullptr) {
+			missing_objects.push_back(object);
+		}
+		else {
+			UpdatePlace(object, place);
+		}
+	}
+	if (!missing_objects.empty()) {
+		InsertBulk(missing_objects.begin(), missing_objects.end());
+	}
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+Remove(Object* object) {
+	ObjectHandle<Object>* place = object_handles_.Find(object);
+	if (place != nullptr) {
+		assert(*place->slot == object);
+		UnlinkRecord(place);
+		object_handles_.Erase(object);
+		number_of_objects_--;
+		RecalculateMaximalDepth();
+		return true;
+	}
+	return false;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+Contains(Object* object) const {
+	return object_handles_.Find(object) != nullptr;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+auto
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+QueryIntersectsRegion(const BoundingBox<Number>& region) const -> Query {
+	Query query;
+	query.impl_.Acquire(this, &region, Query::Impl::QueryType::kIntersects);
+	return query;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+auto
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+QueryInsideRegion(const BoundingBox<Number>& region) const -> Query {
+	Query query;
+	query.impl_.Acquire(this, &region, Query::Impl::QueryType::kInside);
+	return query;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 auto
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
-QueryContainsRegion(const BoundingBox<Number>& region) -> Query {
-	typename Query::Impl* query_impl = GetAvailableQueryFromPool();
-	query_impl->Acquire(this, &region, Query::Impl::QueryType::kContains);
-	return Query(query_impl);
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+QueryContainsRegion(const BoundingBox<Number>& region) const -> Query {
+	Query query;
+	query.impl_.Acquire(this, &region, Query::Impl::QueryType::kContains);
+	return query;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ForEachIntersecting(const BoundingBox<Number>& region, Visitor&& visitor) const {
+	// same fitting logic as the kIntersects query
+	return VisitFitting(detail::IntersectingNodes<Number>(region),
+		detail::IntersectsRegion<Number>(region), std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ForEachContainingPoint(Number x, Number y, Visitor&& visitor) const {
+	// only the nodes which loose bounds contain the point can have such objects
+	return VisitFitting(
+		[x, y](const BoundingBox<Number>&,
+				const BoundingBox<Number>& extended_bounds) -> detail::VisitFit {
+			return extended_bounds.Contains(x, y) ?
+				detail::VisitFit::kPartialFit : detail::VisitFit::kNoFit;
+		},
+		[x, y](const BoundingBox<Number>& object_bounds) {
+			return object_bounds.Contains(x, y);
+		},
+		std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ForEachIntersectingMany(const BoundingBox<Number>* regions, int count, Visitor&& visitor) const {
+	// same fitting logic as ForEachIntersecting() for every region, but the nodes are
+	// walked only once, every stack entry knows the regions which still need it
+	constexpr int kRegionsPerWalk = 64;
+	if (root_ == nullptr) {
+		return true;
+	}
+	for (int first = 0; first < count; first += kRegionsPerWalk) {
+		const BoundingBox<Number>* walk_regions = regions + first;
+		const int walk_count = std::min(count - first, kRegionsPerWalk);
+		struct StackEntry {
+			StackEntry() : node(nullptr), bounds(0, 0, 0, 0), partial(0), free_ride(0) {}
+			const detail::TreeNode<Number, Object>* node;
+			BoundingBox<Number> bounds;
+			unsigned long long partial; ///< regions which objects must be checked
+			unsigned long long free_ride; ///< regions which contain the whole node
+		};
+		std::array<StackEntry, 3 * kInternalMaxDepth + 4> stack;
+		int stack_size = 1;
+		stack[0].node = root_;
+		stack[0].bounds = bounding_box_;
+		stack[0].partial = walk_count == kRegionsPerWalk ? ~0ull : (1ull << walk_count) - 1;
+		stack[0].free_ride = 0;
+		while (stack_size > 0) {
+			stack_size--;
+			const detail::TreeNode<Number, Object>* node = stack[stack_size].node;
+			const BoundingBox<Number> node_bounds = stack[stack_size].bounds;
+			unsigned long long partial = stack[stack_size].partial;
+			unsigned long long free_ride = stack[stack_size].free_ride;
+			Number half_width =
+				(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.width / 2);
+			Number half_height =
+				(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.height / 2);
+			BoundingBox<Number> extended_bounds(
+				(Number)(node_bounds.left - half_width), (Number)(node_bounds.top - half_height),
+				(Number)(node_bounds.width * 2), (Number)(node_bounds.height * 2));
+			for (unsigned long long bits = partial; bits != 0; bits &= bits - 1) {
+				int i = detail::LowestBitIndex(bits);
+				unsigned long long bit = 1ull << i;
+				if (!walk_regions[i].Intersects(extended_bounds)) {
+					partial &= ~bit;
+				}
+				else if (walk_regions[i].Contains(node_bounds)) {
+					partial &= ~bit;
+					free_ride |= bit;
+				}
+			}
+			if ((partial | free_ride) == 0) {
+				continue;
+			}
+
+			// region by region, so the inner loop is the same as a single query has
+			for (unsigned long long bits = partial | free_ride; bits != 0; bits &= bits - 1) {
+				int i = detail::LowestBitIndex(bits);
+				unsigned long long bit = 1ull << i;
+				const int region_index = first + i;
+				if (!detail::VisitFittingRecords(node, (free_ride & bit) != 0,
+						detail::IntersectsRegion<Number>(walk_regions[i]),
+						[&visitor, region_index](Object* object) {
+							return visitor(object, region_index);
+						})) {
+					return false;
+				}
+			}
+
+			// pushed in reverse, so the children are visited in the order of the queries
+			const auto children = detail::ChildrenOf(node);
+			const auto children_bounds = detail::QuarterBounds(node_bounds);
+			for (int i = 3; i >= 0; i--) {
+				if (children[i] != nullptr) {
+					assert(stack_size < (int)stack.size());
+					stack[stack_size].node = children[i];
+					stack[stack_size].bounds = children_bounds[i];
+					stack[stack_size].partial = partial;
+					stack[stack_size].free_ride = free_ride;
+					stack_size++;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ForEachIntersectingPart(const BoundingBox<Number>& region, int part, int part_count,
+		Visitor&& visitor) const {
+	// every part walks the upper levels the same way, level by level, until there are
+	// enough fitting subtrees to share out; the objects of the upper nodes go to part 0
+	assert(part_count > 0 && part >= 0 && part < part_count);
+	detail::IntersectingNodes<Number> node_fits(region);
+	detail::IntersectsRegion<Number> object_fits(region);
+	struct Subtree {
+		const detail::TreeNode<Number, Object>* node;
+		BoundingBox<Number> bounds;
+		bool free_ride;
+	};
+	if (root_ == nullptr) {
+		return true;
+	}
+	std::vector<Subtree> level;
+	std::vector<Subtree> next_level;
+	level.push_back(Subtree{root_, bounding_box_, false});
+	const size_t wanted = (size_t)part_count * kPartSubtreesPerPart;
+	for (int depth = 0; depth < kPartSplitMaxDepth && level.size() < wanted; depth++) {
+		next_level.clear();
+		for (const Subtree& subtree : level) {
+			const BoundingBox<Number>& node_bounds = subtree.bounds;
+			bool free_ride = subtree.free_ride;
+			Number half_width =
+				(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.width / 2);
+			Number half_height =
+				(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.height / 2);
+			if (!free_ride) {
+				BoundingBox<Number> extended_bounds(
+					(Number)(node_bounds.left - half_width), (Number)(node_bounds.top - half_height),
+					(Number)(node_bounds.width * 2), (Number)(node_bounds.height * 2));
+				detail::VisitFit fit = node_fits(node_bounds, extended_bounds);
+				if (fit == detail::VisitFit::kNoFit) {
+					continue;
+				}
+				free_ride = fit == detail::VisitFit::kFreeRide;
+			}
+
+			if (part == 0 &&
+					!detail::VisitFittingRecords(subtree.node, free_ride, object_fits, visitor)) {
+				return false;
+			}
+
+			const auto children = detail::ChildrenOf(subtree.node);
+			const auto children_bounds = detail::QuarterBounds(node_bounds);
+			for (int i = 0; i < 4; i++) {
+				if (children[i] != nullptr) {
+					next_level.push_back(Subtree{children[i], children_bounds[i], free_ride});
+				}
+			}
+		}
+		level.swap(next_level);
+	}
+
+	// round robin, so a dense area is shared out between all of the parts
+	for (size_t i = (size_t)part; i < level.size(); i += (size_t)part_count) {
+		if (!VisitFittingFrom(level[i].node, level[i].bounds, level[i].free_ride,
+				node_fits, object_fits, visitor)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor, typename SummaryVisitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ForEachIntersectingCoarse(const BoundingBox<Number>& region, Number min_node_size,
+		Visitor&& visitor, SummaryVisitor&& summary_visitor) const {
+	// the small nodes aren't walked into, their subtrees are given by their summaries
+	// (a leaf has none, its few records are summed up here)
+	if (root_ == nullptr) {
+		return true;
+	}
+	const detail::IntersectsRegion<Number> object_fits(region);
+	return WalkFittingFrom(root_, bounding_box_, false, detail::IntersectingNodes<Number>(region),
+		[&object_fits, &visitor, &summary_visitor, min_node_size](
+				const detail::TreeNode<Number, Object>* node,
+				const BoundingBox<Number>& node_bounds, bool free_ride, int) {
+			if (node_bounds.width >= min_node_size) {
+				return detail::VisitFittingRecords(node, free_ride, object_fits, visitor) ?
+					detail::NodeVisit::kVisitChildren : detail::NodeVisit::kStop;
+			}
+			detail::NodeSummary<Number> summary;
+			if (node->summary != nullptr) {
+				summary = *node->summary;
+			}
+			else {
+				detail::AddRecordsToSummary(node, &summary);
+			}
+			if (summary.count > 0 &&
+					!summary_visitor(node_bounds, summary.count, summary.bounds)) {
+				return detail::NodeVisit::kStop;
+			}
+			return detail::NodeVisit::kSkipChildren;
+		});
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename NodeFitter, typename ObjectFitter, typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+VisitFitting(NodeFitter&& node_fits, ObjectFitter&& object_fits, Visitor&& visitor) const {
+	if (root_ == nullptr) {
+		return true;
+	}
+	return VisitFittingFrom(root_, bounding_box_, false, std::forward<NodeFitter>(node_fits),
+		std::forward<ObjectFitter>(object_fits), std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename NodeFitter, typename ObjectFitter, typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+VisitFittingFrom(const detail::TreeNode<Number, Object>* start, const BoundingBox<Number>& start_bounds,
+		bool start_free_ride, NodeFitter&& node_fits, ObjectFitter&& object_fits,
+		Visitor&& visitor) const {
+	return WalkFittingFrom(start, start_bounds, start_free_ride,
+		std::forward<NodeFitter>(node_fits),
+		[&object_fits, &visitor](const detail::TreeNode<Number, Object>* node,
+				const BoundingBox<Number>&, bool free_ride, int) {
+			return detail::VisitFittingRecords(node, free_ride, object_fits, visitor) ?
+				detail::NodeVisit::kVisitChildren : detail::NodeVisit::kStop;
+		});
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename NodeFitter, typename NodeVisitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+WalkFittingFrom(const detail::TreeNode<Number, Object>* start, const BoundingBox<Number>& start_bounds,
+		bool start_free_ride, NodeFitter&& node_fits, NodeVisitor&& node_visitor) const {
+	// the nodes wait on a fixed stack: every step pops one node and pushes
+	// at most four, so it's never deeper than this; the visitor of a fitting node
+	// tells whether its children are walked too, it gets their depth below the start
+	struct StackEntry {
+		StackEntry() : node(nullptr), bounds(0, 0, 0, 0), free_ride(false), depth(0) {}
+		const detail::TreeNode<Number, Object>* node;
+		BoundingBox<Number> bounds;
+		bool free_ride;
+		int depth;
+	};
+	std::array<StackEntry, 3 * kInternalMaxDepth + 4> stack;
+	int stack_size = 1;
+	stack[0].node = start;
+	stack[0].bounds = start_bounds;
+	stack[0].free_ride = start_free_ride;
+	stack[0].depth = 0;
+	while (stack_size > 0) {
+		stack_size--;
+		const detail::TreeNode<Number, Object>* node = stack[stack_size].node;
+		const BoundingBox<Number> node_bounds = stack[stack_size].bounds;
+		bool free_ride = stack[stack_size].free_ride;
+		int depth = stack[stack_size].depth;
+		Number half_width =
+			(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.width / 2);
+		Number half_height =
+			(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.height / 2);
+		if (!free_ride) {
+			BoundingBox<Number> extended_bounds(
+				(Number)(node_bounds.left - half_width), (Number)(node_bounds.top - half_height),
+				(Number)(node_bounds.width * 2), (Number)(node_bounds.height * 2));
+			detail::VisitFit fit = node_fits(node_bounds, extended_bounds);
+			if (fit == detail::VisitFit::kNoFit) {
+				continue;
+			}
+			free_ride = fit == detail::VisitFit::kFreeRide;
+		}
+
+		const detail::NodeVisit visit = node_visitor(node, node_bounds, free_ride, depth);
+		if (visit == detail::NodeVisit::kStop) {
+			return false;
+		}
+		if (visit == detail::NodeVisit::kSkipChildren) {
+			continue;
+		}
+
+		// pushed in reverse, so the children are visited in the order of the queries
+		const auto children = detail::ChildrenOf(node);
+		const auto children_bounds = detail::QuarterBounds(node_bounds);
+		for (int i = 3; i >= 0; i--) {
+			if (children[i] != nullptr) {
+				assert(stack_size < (int)stack.size());
+				stack[stack_size].node = children[i];
+				stack[stack_size].bounds = children_bounds[i];
+				stack[stack_size].free_ride = free_ride;
+				stack[stack_size].depth = depth + 1;
+				stack_size++;
+			}
+		}
+	}
+	return true;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+ObjectT*
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+FindTopmostContainingPoint(Number x, Number y) const {
+	static_assert(!std::is_void<ZOrderExtractor>::value,
+		"the topmost object can't be found without a ZOrderExtractorT");
+	// same fixed stack as VisitFitting() has, but the children are pushed by their
+	// summaries, so the one which can have the highest z-order is visited first
+	struct StackEntry {
+		StackEntry() : node(nullptr), bounds(0, 0, 0, 0) {}
+		const detail::TreeNode<Number, Object>* node;
+		BoundingBox<Number> bounds;
+	};
+	std::array<StackEntry, 3 * kInternalMaxDepth + 4> stack;
+	Object* topmost = nullptr;
+	unsigned long long topmost_z_order = 0;
+	if (root_ == nullptr) {
+		return nullptr;
+	}
+	int stack_size = 1;
+	stack[0].node = root_;
+	stack[0].bounds = bounding_box_;
+	while (stack_size > 0) {
+		stack_size--;
+		const detail::TreeNode<Number, Object>* node = stack[stack_size].node;
+		const BoundingBox<Number> node_bounds = stack[stack_size].bounds;
+		if (topmost != nullptr && node->max_z_order <= topmost_z_order) {
+			continue; // nothing in here can beat the best so far
+		}
+		Number half_width =
+			(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.width / 2);
+		Number half_height =
+			(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.height / 2);
+		BoundingBox<Number> extended_bounds(
+			(Number)(node_bounds.left - half_width), (Number)(node_bounds.top - half_height),
+			(Number)(node_bounds.width * 2), (Number)(node_bounds.height * 2));
+		if (!extended_bounds.Contains(x, y)) {
+			continue;
+		}
+
+		for (int r = 0; r < node->size; r++) {
+			const typename detail::TreeNode<Number, Object>::Record& record = node->records[r];
+			// the bounds first, so only the objects under the point are touched
+			if (record.object == nullptr || !record.bounds.Contains(x, y)) {
+				continue;
+			}
+			unsigned long long z_order = ZOrderOf::Get(record.object);
+			if (topmost == nullptr || z_order > topmost_z_order) {
+				topmost = record.object;
+				topmost_z_order = z_order;
+			}
+		}
+
+		const auto children = detail::ChildrenOf(node);
+		const auto children_bounds = detail::QuarterBounds(node_bounds);
+		int first_child = stack_size;
+		for (int i = 0; i < 4; i++) {
+			if (children[i] == nullptr ||
+					(topmost != nullptr && children[i]->max_z_order <= topmost_z_order)) {
+				continue;
+			}
+			// insertion sort by the summaries, the highest one ends up on the top
+			assert(stack_size < (int)stack.size());
+			int position = stack_size;
+			while (position > first_child &&
+					stack[position - 1].node->max_z_order > children[i]->max_z_order) {
+				stack[position] = stack[position - 1];
+				position--;
+			}
+			stack[position].node = children[i];
+			stack[position].bounds = children_bounds[i];
+			stack_size++;
+		}
+	}
+	return topmost;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ForEachNearest(Number x, Number y, Number max_distance, Visitor&& visitor) const {
+	const double max_squared_distance = (double)max_distance * (double)max_distance;
+	return VisitBestFirst(
+		[x, y, max_squared_distance](const BoundingBox<Number>& bounds, double* squared_distance) {
+			*squared_distance = detail::SquaredDistance(bounds, x, y);
+			return *squared_distance <= max_squared_distance;
+		},
+		std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ForEachOnSegment(Number x1, Number y1, Number x2, Number y2, Visitor&& visitor) const {
+	// the nodes the segment doesn't cross are never entered
+	return VisitBestFirst(
+		[x1, y1, x2, y2](const BoundingBox<Number>& bounds, double* entry) {
+			return detail::SegmentEntry(bounds, x1, y1, x2, y2, entry);
+		},
+		std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ForEachNode(const BoundingBox<Number>& region, Visitor&& visitor) const {
+	VisitNodes(&region, std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+auto
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+GetStatistics() const -> Statistics {
+	Statistics statistics;
+	VisitNodes(nullptr, [&statistics](const BoundingBox<Number>&, int depth, int object_count) {
+		if ((int)statistics.nodes_per_depth.size() <= depth) {
+			statistics.nodes_per_depth.resize(depth + 1, 0);
+			statistics.objects_per_depth.resize(depth + 1, 0);
+		}
+		statistics.nodes_per_depth[depth]++;
+		statistics.objects_per_depth[depth] += object_count;
+		statistics.node_count++;
+		statistics.object_count += object_count;
+		statistics.max_objects_per_node = std::max(statistics.max_objects_per_node, object_count);
+		return true;
+	});
+	if (statistics.node_count > 0) {
+		statistics.average_objects_per_node =
+			(double)statistics.object_count / statistics.node_count;
+	}
+	statistics.removed_records = removed_records_;
+	allocator_.CountBlocks(&statistics.used_blocks, &statistics.free_blocks);
+	statistics.maximal_depth = maximal_depth_;
+	statistics.loose_bounds = bounding_box_;
+	return statistics;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+int
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+CountIntersecting(const BoundingBox<Number>& region) const {
+	return SummarizeIntersecting(region, nullptr);
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+GetIntersectingBounds(const BoundingBox<Number>& region, BoundingBox<Number>* bounds) const {
+	BoundingBox<Number> found(0, 0, 0, 0);
+	if (SummarizeIntersecting(region, &found) == 0) {
+		return false;
+	}
+	*bounds = found;
+	return true;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Ranker, typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+VisitBestFirst(Ranker&& rank, Visitor&& visitor) const {
+	// the nodes and the objects wait together ordered by their rank, which must
+	// not decrease from a box to the boxes inside of it: a node is ranked by its
+	// loose bounds, those contain its whole subtree, so nothing inside ranks lower
+	if (root_ == nullptr) {
+		return true;
+	}
+	std::vector<BestFirstEntry> queue_storage;
+	queue_storage.reserve(64);
+	std::priority_queue<BestFirstEntry, std::vector<BestFirstEntry>, BestFirstEntryGoesLater> queue(
+		BestFirstEntryGoesLater(), std::move(queue_storage));
+	auto push_node = [&queue, &rank](const detail::TreeNode<Number, Object>* node,
+			const BoundingBox<Number>& node_bounds, int depth) {
+		Number half_width =
+			(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.width / 2);
+		Number half_height =
+			(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.height / 2);
+		BoundingBox<Number> extended_bounds(
+			(Number)(node_bounds.left - half_width), (Number)(node_bounds.top - half_height),
+			(Number)(node_bounds.width * 2), (Number)(node_bounds.height * 2));
+		double key;
+		if (rank(extended_bounds, &key)) {
+			queue.push(BestFirstEntry{key, depth, node, nullptr, node_bounds});
+		}
+	};
+	push_node(root_, bounding_box_, 0);
+	while (!queue.empty()) {
+		BestFirstEntry entry = queue.top();
+		queue.pop();
+		if (entry.node == nullptr) {
+			if (!visitor(entry.object)) {
+				return false;
+			}
+			continue;
+		}
+
+		for (int r = 0; r < entry.node->size; r++) {
+			const typename detail::TreeNode<Number, Object>::Record& record = entry.node->records[r];
+			if (record.object == nullptr) {
+				continue;
+			}
+			double key;
+			if (rank(record.bounds, &key)) {
+				queue.push(BestFirstEntry{key, kInternalMaxDepth + 1, nullptr, record.object,
+					record.bounds});
+			}
+		}
+
+		const auto children = detail::ChildrenOf(entry.node);
+		const auto children_bounds = detail::QuarterBounds(entry.node_bounds);
+		for (int i = 0; i < 4; i++) {
+			if (children[i] != nullptr) {
+				push_node(children[i], children_bounds[i], entry.depth + 1);
+			}
+		}
+	}
+	return true;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+VisitNodes(const BoundingBox<Number>* region, Visitor&& visitor) const {
+	if (root_ == nullptr) {
+		return;
+	}
+	// the nodes themselves fit by their tight bounds, a rejected node keeps its children away
+	WalkFittingFrom(root_, bounding_box_, false,
+		[region](const BoundingBox<Number>& node_bounds, const BoundingBox<Number>&) {
+			return region == nullptr || region->Intersects(node_bounds) ?
+				detail::VisitFit::kPartialFit : detail::VisitFit::kNoFit;
+		},
+		[this, &visitor](const detail::TreeNode<Number, Object>* node,
+				const BoundingBox<Number>& node_bounds, bool, int depth) {
+			int object_count = node->size;
+			if (removed_records_ > 0) {
+				for (int i = 0; i < node->size; i++) {
+					if (node->records[i].object == nullptr) {
+						object_count--;
+					}
+				}
+			}
+			return visitor(node_bounds, depth, object_count) ?
+				detail::NodeVisit::kVisitChildren : detail::NodeVisit::kSkipChildren;
+		});
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+int
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+SummarizeIntersecting(const BoundingBox<Number>& region, BoundingBox<Number>* bounds) const {
+	// a subtree in the free ride is taken from the summary of its node instead of its
+	// records (unless the bounds are wanted and the summary has stale ones)
+	detail::NodeSummary<Number> found;
+	if (root_ != nullptr) {
+		const detail::IntersectsRegion<Number> object_fits(region);
+		WalkFittingFrom(root_, bounding_box_, false, detail::IntersectingNodes<Number>(region),
+			[&found, &object_fits, bounds](const detail::TreeNode<Number, Object>* node,
+					const BoundingBox<Number>&, bool free_ride, int) {
+				if (free_ride && node->summary != nullptr &&
+						(bounds == nullptr || node->summary->exact)) {
+					detail::MergeSummaries(&found, *node->summary);
+					return detail::NodeVisit::kSkipChildren;
+				}
+				detail::SummarizeFittingRecords(node, free_ride, object_fits, &found);
+				return detail::NodeVisit::kVisitChildren;
+			});
+	}
+	if (bounds != nullptr && found.count > 0) {
+		*bounds = found.bounds;
+	}
+	return found.count;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 const BoundingBox<NumberT>&
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
 GetBoundingBox() const {
 	return bounding_box_;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 void
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
 ForceCleanup() {
-	Query query = QueryIntersectsRegion(bounding_box_);
-	while (!query.EndOfQuery()) {
-		query.Next();
+	if (running_queries_ > 0) {
+		return; // they hold positions in the arrays
+	}
+	AbandonCleanup();
+	while (!ContinueCleanupPass(std::numeric_limits<int>::max())) {
 	}
 	allocator_.ReleaseFreeBlocks();
+	cleanup_size_class_ = detail::BlocksAllocator::kSizeClasses;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+CleanupStep(int max_objects) {
+	if (running_queries_ > 0) {
+		return true; // nothing can be moved until they are closed
+	}
+	if (cleanup_size_class_ < detail::BlocksAllocator::kSizeClasses) {
+		// after the pass the free blocks are released, one size class a step
+		allocator_.ReleaseFreeBlocks(cleanup_size_class_++);
+		if (cleanup_size_class_ < detail::BlocksAllocator::kSizeClasses) {
+			return false;
+		}
+		// removals behind the pass need another one
+		return !NeedsCleanup();
+	}
+	if (ContinueCleanupPass(max_objects)) {
+		cleanup_size_class_ = 0;
+	}
+	return false;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ContinueCleanupPass(int max_records) {
+	// walks the whole tree, a node is tidied up when the walk enters it and its empty
+	// children are pruned on the way up, only a new root would be missed between
+	// the calls (nothing else deletes nodes), then the pass starts over
+	detail::FullTreeTraversal<Number, Object>& trav = cleanup_traversal_;
+	if (cleanup_root_ != nullptr && cleanup_root_ != root_) {
+		AbandonCleanup();
+	}
+	if (cleanup_root_ == nullptr) {
+		if (root_ == nullptr) {
+			untidy_nodes_ = 0;
+			return true;
+		}
+		cleanup_root_ = root_;
+		cleanup_untidy_nodes_ = untidy_nodes_;
+		trav.StartAt(root_, bounding_box_);
+		max_records -= TidyNode(root_, 0);
+	}
+	while (max_records > 0) {
+		detail::TreeNode<Number, Object>* node = trav.GetNode();
+		detail::TreeNode<Number, Object>* child = nullptr;
+		switch (trav.GetNodeCurrentChild()) {
+		case detail::ChildPosition::kNone:
+			if ((child = node->top_left) != nullptr) {
+				trav.GoTopLeft();
+			}
+			else {
+				trav.SetNodeCurrentChild(detail::ChildPosition::kTopLeft);
+			}
+			break;
+		case detail::ChildPosition::kTopLeft:
+			if ((child = node->top_right) != nullptr) {
+				trav.GoTopRight();
+			}
+			else {
+				trav.SetNodeCurrentChild(detail::ChildPosition::kTopRight);
+			}
+			break;
+		case detail::ChildPosition::kTopRight:
+			if ((child = node->bottom_right) != nullptr) {
+				trav.GoBottomRight();
+			}
+			else {
+				trav.SetNodeCurrentChild(detail::ChildPosition::kBottomRight);
+			}
+			break;
+		case detail::ChildPosition::kBottomRight:
+			if ((child = node->bottom_left) != nullptr) {
+				trav.GoBottomLeft();
+			}
+			else {
+				trav.SetNodeCurrentChild(detail::ChildPosition::kBottomLeft);
+			}
+			break;
+		case detail::ChildPosition::kBottomLeft:
+			{
+				// left after the children, so their summaries are up to date
+				RecalculateSummary(node);
+				const bool remove_node = node->size == 0 &&
+					node->top_left == nullptr && node->top_right == nullptr &&
+					node->bottom_right == nullptr && node->bottom_left == nullptr;
+				if (trav.GetDepth() == 0) {
+					if (remove_node) {
+						DeleteNode(root_);
+						root_ = nullptr;
+						bounding_box_ = BoundingBox<Number>(0, 0, 0, 0);
+					}
+					cleanup_root_ = nullptr;
+					untidy_nodes_ -= cleanup_untidy_nodes_;
+					return true;
+				}
+				trav.GoUp();
+				if (remove_node) {
+					switch (trav.GetNodeCurrentChild()) {
+					case detail::ChildPosition::kTopLeft:
+						trav.GetNode()->top_left = nullptr;
+						break;
+					case detail::ChildPosition::kTopRight:
+						trav.GetNode()->top_right = nullptr;
+						break;
+					case detail::ChildPosition::kBottomRight:
+						trav.GetNode()->bottom_right = nullptr;
+						break;
+					case detail::ChildPosition::kBottomLeft:
+						trav.GetNode()->bottom_left = nullptr;
+						break;
+					case detail::ChildPosition::kNone:
+						assert(false);
+					}
+					DeleteNode(node);
+				}
+			}
+			break;
+		}
+		if (child != nullptr) {
+			max_records -= TidyNode(child, trav.GetDepth());
+		}
+	}
+	return false;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+AbandonCleanup() {
+	cleanup_root_ = nullptr;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+NeedsCleanup() const {
+	return untidy_nodes_ > 0 || removed_records_ > 0;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+int
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+GetRemovedCount() const {
+	return removed_records_;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 int
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
 GetSize() const {
 	return number_of_objects_;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+long long
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+GetInPlaceUpdateCount() const {
+	return in_place_updates_;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+long long
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+GetRelinkingUpdateCount() const {
+	return relinking_updates_;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 void
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ResetUpdateCounters() {
+	in_place_updates_ = 0;
+	relinking_updates_ = 0;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
 Clear() {
 	DeleteTree();
 }
 
 
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 void
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
 RecalculateMaximalDepth() {
 	do {
 		if (maximal_depth_ < kInternalMaxDepth &&
@@ -1121,6 +2666,7 @@ RecalculateMaximalDepth() {
 		else if (maximal_depth_ > kInternalMinDepth &&
 				number_of_objects_ <= 1ll << ((maximal_depth_ - 1) << 1)) {
 			maximal_depth_--;
+			untidy_nodes_++; // the deepest nodes are relinked by the cleanup
 		}
 		else {
 			break;
@@ -1128,16 +2674,18 @@ RecalculateMaximalDepth() {
 	} while (true);
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 void
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
 DeleteTree() {
-	object_pointers_.clear();
+	AbandonCleanup();
+	object_handles_.Clear();
 	detail::FullTreeTraversal<Number, Object>& trav = internal_traversal_;
 	trav.StartAt(root_, bounding_box_);
 	while (root_ != nullptr) {
 		assert(trav.GetDepth() >= 0 && trav.GetDepth() <= kInternalMaxDepth);
-		detail::TreeNode<Object>* node = trav.GetNode();
+		detail::TreeNode<Number, Object>* node = trav.GetNode();
 		if (node->top_left != nullptr) {
 			trav.GoTopLeft();
 		}
@@ -1174,11 +2722,13 @@ DeleteTree() {
 					trav.GetNode()->bottom_left = nullptr;
 					break;
 				}
-				allocator_.Delete(node);
+				object_handles_.ReleaseAll(node->records, node->size);
+				DeleteNode(node);
 			}
 			else {
 				assert(node == root_);
-				allocator_.Delete(root_);
+				object_handles_.ReleaseAll(root_->records, root_->size);
+				DeleteNode(root_);
 				root_ = nullptr;
 			}
 		}
@@ -1186,81 +2736,531 @@ DeleteTree() {
 
 	bounding_box_ = BoundingBox<Number>(0, 0, 0, 0);
 	number_of_objects_ = 0;
+	assert(removed_records_ == 0);
+	untidy_nodes_ = 0;
 	maximal_depth_ = kInternalMinDepth;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-ObjectT**
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
-InsertIntoTree(Object* object) {
-	BoundingBox<Number> object_bounds(0,0,0,0);
-	BoundingBoxExtractor::ExtractBoundingBox(object, &object_bounds);
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+GetObjectPlacement(const BoundingBox<Number>& object_bounds,
+		Number* center_x, Number* center_y, Number* maximal_extent) {
 	assert(object_bounds.width >= 0);
 	assert(object_bounds.height >= 0);
 	assert(object_bounds.left <= object_bounds.left + object_bounds.width);
 	assert(object_bounds.top <= object_bounds.top + object_bounds.height);
-	Number maximal_object_extent = object_bounds.width >= object_bounds.height ?
+	*maximal_extent = object_bounds.width >= object_bounds.height ?
 		object_bounds.width : object_bounds.height;
-	if (maximal_object_extent < kMinimalObjectExtent) {
-		maximal_object_extent = kMinimalObjectExtent;
+	if (*maximal_extent < kMinimalObjectExtent) {
+		*maximal_extent = kMinimalObjectExtent;
 	}
-	Number object_center_x = (Number)(object_bounds.left +
+	*center_x = (Number)(object_bounds.left +
 		(Number)((typename detail::MakeDistance<Number>::Type)object_bounds.width / 2));
-	Number object_center_y = (Number)(object_bounds.top +
+	*center_y = (Number)(object_bounds.top +
 		(Number)((typename detail::MakeDistance<Number>::Type)object_bounds.height / 2));
+}
 
-	if (root_ != nullptr) {
-		assert(number_of_objects_ >= 0);
-		assert(bounding_box_.width > 0);
-		assert(bounding_box_.width == bounding_box_.height);
-
-		int depth_increase = 0;
-		while (!bounding_box_.Contains(object_center_x, object_center_y) ||
-				maximal_object_extent > bounding_box_.width) {
-			Number previous_size = bounding_box_.width;
-			bounding_box_.width = (Number)(bounding_box_.width * 2);
-			bounding_box_.height = bounding_box_.width;
-			Number previous_half =
-				(Number)((typename detail::MakeDistance<Number>::Type)previous_size / 2);
-			Number bb_center_x = (Number)(bounding_box_.left + previous_half);
-			Number bb_center_y = (Number)(bounding_box_.top + previous_half);
-			detail::TreeNode<Object>* old_root = root_;
-			root_ = allocator_.New<detail::TreeNode<Object>>(allocator_);
-			if (object_center_x <= bb_center_x) {
-				bounding_box_.left = (Number)(bounding_box_.left - previous_size);
-				if (object_center_y <= bb_center_y) {
-					bounding_box_.top = (Number)(bounding_box_.top - previous_size);
-					root_->bottom_right = old_root;
-				}
-				else {
-					root_->top_right = old_root;
-				}
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+CreateRoot(Number object_center_x, Number object_center_y,
+		Number maximal_object_extent) {
+	assert(root_ == nullptr);
+	bounding_box_.width =
+		(Number)((typename detail::MakeDistance<Number>::Type)maximal_object_extent * 2 * 7 / 8);
+	bounding_box_.height = bounding_box_.width;
+	Number extent_half =
+		(Number)((typename detail::MakeDistance<Number>::Type)bounding_box_.width / 2);
+	bounding_box_.left = (Number)(object_center_x - extent_half);
+	bounding_box_.top = (Number)(object_center_y - extent_half);
+	assert(bounding_box_.left < bounding_box_.left + bounding_box_.width);
+	assert(bounding_box_.top < bounding_box_.top + bounding_box_.height);
+	root_ = allocator_.New<detail::TreeNode<Number, Object>>();
+	root_growths_ = 0;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+GrowRoot(Number object_center_x, Number object_center_y,
+		Number maximal_object_extent) {
+	assert(root_ != nullptr);
+	assert(number_of_objects_ >= 0);
+	assert(bounding_box_.width > 0);
+	assert(bounding_box_.width == bounding_box_.height);
+
+	int depth_increase = 0;
+	while (!bounding_box_.Contains(object_center_x, object_center_y) ||
+			maximal_object_extent > bounding_box_.width) {
+		Number previous_size = bounding_box_.width;
+		bounding_box_.width = (Number)(bounding_box_.width * 2);
+		bounding_box_.height = bounding_box_.width;
+		Number previous_half =
+			(Number)((typename detail::MakeDistance<Number>::Type)previous_size / 2);
+		Number bb_center_x = (Number)(bounding_box_.left + previous_half);
+		Number bb_center_y = (Number)(bounding_box_.top + previous_half);
+		detail::TreeNode<Number, Object>* old_root = root_;
+		root_ = allocator_.New<detail::TreeNode<Number, Object>>();
+		root_->max_z_order = old_root->max_z_order;
+		if (object_center_x <= bb_center_x) {
+			bounding_box_.left = (Number)(bounding_box_.left - previous_size);
+			if (object_center_y <= bb_center_y) {
+				bounding_box_.top = (Number)(bounding_box_.top - previous_size);
+				root_->bottom_right = old_root;
 			}
 			else {
-				if (object_center_y <= bb_center_y) {
-					bounding_box_.top = (Number)(bounding_box_.top - previous_size);
-					root_->bottom_left = old_root;
-				}
-				else {
-					root_->top_left = old_root;
-				}
+				root_->top_right = old_root;
+			}
+		}
+		else {
+			if (object_center_y <= bb_center_y) {
+				bounding_box_.top = (Number)(bounding_box_.top - previous_size);
+				root_->bottom_left = old_root;
+			}
+			else {
+				root_->top_left = old_root;
+			}
+		}
+		old_root->parent = root_;
+		RecalculateSummary(root_);
+		depth_increase++;
+		assert(depth_increase < kInternalMaxDepth);
+		(void)depth_increase;
+		root_growths_++;
+		assert(bounding_box_.left < bounding_box_.left + bounding_box_.width);
+		assert(bounding_box_.top < bounding_box_.top + bounding_box_.height);
+		// If this happens with integral types you are close to get out of bounds
+		// The bounding box of things should be at least 1/8 of the total interval spanned
+		assert(!std::is_integral<Number>::value ||
+			bounding_box_.width < std::numeric_limits<Number>::max() / 8 * 7);
+		assert(!std::is_integral<Number>::value ||
+			bounding_box_.height < std::numeric_limits<Number>::max() / 8 * 7);
+	}
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+int
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+GetTargetPath(Number object_center_x, Number object_center_y,
+		Number maximal_object_extent, unsigned long long* path) const {
+	// same descent as InsertIntoTree() does, without touching any node,
+	// the child positions are collected two bits per level (x low, y high)
+	BoundingBox<Number> node_bounds = bounding_box_;
+	assert(node_bounds.Contains(object_center_x, object_center_y));
+	*path = 0;
+	int depth = 0;
+	do {
+		Number maximal_bb_extent =
+				node_bounds.width >= node_bounds.height ?
+					node_bounds.width : node_bounds.height;
+		Number half_bb_extent =
+			(Number)((typename detail::MakeDistance<Number>::Type)maximal_bb_extent / 2);
+		assert(maximal_object_extent <= maximal_bb_extent);
+
+		if (maximal_object_extent > half_bb_extent || depth >= maximal_depth_) {
+			break;
+		}
+
+		Number half_width =
+			(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.width / 2);
+		Number half_height =
+			(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.height / 2);
+		Number node_center_x = (Number)(node_bounds.left + half_width);
+		Number node_center_y = (Number)(node_bounds.top + half_height);
+		// written to compile into conditional moves, the sides are hard to predict
+		bool right = !(object_center_x < node_center_x);
+		bool bottom = !(object_center_y < node_center_y);
+		node_bounds.width = right ?
+			(Number)(node_bounds.left + node_bounds.width - node_center_x) : half_width;
+		node_bounds.left = right ? node_center_x : node_bounds.left;
+		node_bounds.height = bottom ?
+			(Number)(node_bounds.top + node_bounds.height - node_center_y) : half_height;
+		node_bounds.top = bottom ? node_center_y : node_bounds.top;
+		*path = *path << 2 | (unsigned long long)right | (unsigned long long)bottom << 1;
+		depth++;
+	} while (true);
+	return depth;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+UpdatePlace(Object* object, ObjectHandle<Object>* place) {
+	assert(*place->slot == object);
+
+	// small moves usually keep the object in its node, then only its record is refreshed
+	BoundingBox<Number> object_bounds(0, 0, 0, 0);
+	BoundingBoxExtractor::ExtractBoundingBox(object, &object_bounds);
+	Number object_center_x, object_center_y, maximal_object_extent;
+	GetObjectPlacement(object_bounds, &object_center_x, &object_center_y,
+		&maximal_object_extent);
+	if (bounding_box_.Contains(object_center_x, object_center_y) &&
+			maximal_object_extent <= bounding_box_.width) {
+		unsigned long long path;
+		int depth = GetTargetPath(object_center_x, object_center_y,
+			maximal_object_extent, &path);
+		if (place->node_key != 0 && MakeNodeKey(path, depth) == place->node_key) {
+			BoundingBox<Number>& record_bounds = detail::RecordOfSlot<Number>(place->slot)->bounds;
+			MoveInSummaries(static_cast<detail::TreeNode<Number, Object>*>(place->node),
+				record_bounds, object_bounds);
+			record_bounds = object_bounds;
+			in_place_updates_++;
+			return;
+		}
+	}
+
+	relinking_updates_++;
+	UnlinkRecord(place);
+	InsertIntoTree(object, object_bounds, place);
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+unsigned long long
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+MakeNodeKey(unsigned long long path, int depth) const {
+	// the leading one bit separates the depth from the path, and as the paths
+	// of the existing nodes get longer when the root grows, growths are counted in
+	// (the bounds can only double so many times, they never reach the top bits)
+	assert(depth >= 0 && depth <= kInternalMaxDepth);
+	assert(path < 1ull << (2 * depth));
+	if (depth > kNodeKeyMaxDepth) {
+		return 0; // no key, such objects are always relinked
+	}
+	return (unsigned long long)root_growths_ << (2 * kNodeKeyMaxDepth + 1) |
+		1ull << (2 * depth) | path;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+ObjectT**
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+InsertIntoNode(detail::TreeNode<Number, Object>* node, Object* object,
+		const BoundingBox<Number>& object_bounds) {
+	if (node->size == node->capacity) {
+		MakeRoomInNode(node);
+	}
+	typename detail::TreeNode<Number, Object>::Record* record = node->records + node->size;
+	new(record) typename detail::TreeNode<Number, Object>::Record{object, object_bounds};
+	node->size++;
+	return &record->object;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+MakeRoomInNode(detail::TreeNode<Number, Object>* node) {
+	assert(node->size == node->capacity);
+	// a full array is compacted instead of grown if a quarter of it is removed records,
+	// but only while no query runs, those hold positions in the arrays
+	if (running_queries_ == 0 && node->capacity >= 4) {
+		int removed = 0;
+		for (int i = 0; i < node->size; i++) {
+			if (node->records[i].object == nullptr) {
+				removed++;
+			}
+		}
+		if (removed >= node->capacity / 4) {
+			CompactNode(node);
+			if (node->size < node->capacity) {
+				return;
 			}
-			depth_increase++;
-			assert(depth_increase < kInternalMaxDepth);
-			(void)depth_increase;
-			assert(bounding_box_.left < bounding_box_.left + bounding_box_.width);
-			assert(bounding_box_.top < bounding_box_.top + bounding_box_.height);
-			// If this happens with integral types you are close to get out of bounds
-			// The bounding box of things should be at least 1/8 of the total interval spanned
-			assert(!std::is_integral<Number>::value ||
-				bounding_box_.width < std::numeric_limits<Number>::max() / 8 * 7);
-			assert(!std::is_integral<Number>::value ||
-				bounding_box_.height < std::numeric_limits<Number>::max() / 8 * 7);
 		}
+	}
+
+	ReserveInNode(node, node->capacity == 0 ? 1 : node->capacity * 2);
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ReserveInNode(detail::TreeNode<Number, Object>* node, int capacity) {
+	if (capacity > node->capacity) {
+		MoveRecords(node, capacity);
+	}
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+MoveRecords(detail::TreeNode<Number, Object>* node, int capacity) {
+	using Record = typename detail::TreeNode<Number, Object>::Record;
+	assert(capacity >= node->size);
+	// the handles point into the array, those of the moved records are redirected
+	detail::BlocksAllocatorAdaptor<Record> adaptor(allocator_);
+	Record* records = adaptor.allocate((std::size_t)capacity);
+	for (int i = 0; i < node->size; i++) {
+		new(records + i) Record(node->records[i]);
+		if (records[i].object != nullptr) {
+			object_handles_.Find(records[i].object)->slot = &records[i].object;
+		}
+	}
+	if (node->records != nullptr) {
+		adaptor.deallocate(node->records, (std::size_t)node->capacity);
+	}
+	node->records = records;
+	node->capacity = capacity;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+CompactNode(detail::TreeNode<Number, Object>* node) {
+	int kept = 0;
+	for (int i = 0; i < node->size; i++) {
+		Object* object = node->records[i].object;
+		if (object == nullptr) {
+			continue;
+		}
+		if (kept != i) {
+			node->records[kept] = node->records[i];
+			object_handles_.Find(object)->slot = &node->records[kept].object;
+		}
+		kept++;
+	}
+	removed_records_ -= node->size - kept;
+	node->size = kept;
+	if (kept == 0) {
+		ReleaseRecords(node);
+		return;
+	}
+	// an array left mostly empty (after a lot of removals) is halved until a quarter is used
+	int capacity = node->capacity;
+	while (capacity > 1 && capacity / 4 >= kept) {
+		capacity /= 2;
+	}
+	if (capacity < node->capacity) {
+		MoveRecords(node, capacity);
+	}
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ReleaseRecords(detail::TreeNode<Number, Object>* node) {
+	for (int i = 0; i < node->size; i++) {
+		if (node->records[i].object == nullptr) {
+			removed_records_--;
+		}
+	}
+	if (node->records != nullptr) {
+		detail::BlocksAllocatorAdaptor<typename detail::TreeNode<Number, Object>::Record>(allocator_)
+			.deallocate(node->records, (std::size_t)node->capacity);
+	}
+	node->records = nullptr;
+	node->size = 0;
+	node->capacity = 0;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+UnlinkRecord(ObjectHandle<Object>* place) {
+	detail::TreeNode<Number, Object>* node =
+		static_cast<detail::TreeNode<Number, Object>*>(place->node);
+	RemoveFromSummaries(node, detail::RecordOfSlot<Number>(place->slot)->bounds);
+	// the last record of the node takes the place of the removed one, so the searches never
+	// meet removed records, but an open query could skip or repeat the moved one that way,
+	// so while there are any the record is only marked removed until a cleanup
+	if (running_queries_ > 0) {
+		*place->slot = nullptr;
+		removed_records_++;
+		return;
+	}
+	using Record = typename detail::TreeNode<Number, Object>::Record;
+	Record* record = detail::RecordOfSlot<Number>(place->slot);
+	assert(record >= node->records && record < node->records + node->size);
+	Record* last = node->records + node->size - 1;
+	if (record != last) {
+		*record = *last;
+		if (record->object != nullptr) {
+			object_handles_.Find(record->object)->slot = &record->object;
+		}
+	}
+	node->size--;
+	if (node->size == 0) {
+		ReleaseRecords(node);
+		untidy_nodes_++; // left for the cleanup to prune
+	}
+	else if (node->size <= node->capacity / 4) {
+		untidy_nodes_++; // left for the cleanup to shrink
+	}
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+RecalculateSummary(detail::TreeNode<Number, Object>* node) {
+	// a new summary, or a stale one, is made again from the records of the node and the
+	// summaries (else the records) of its children, a node left without children loses it
+	const detail::TreeNode<Number, Object>* children[4] = {
+		node->top_left, node->top_right, node->bottom_left, node->bottom_right};
+	if (children[0] == nullptr && children[1] == nullptr &&
+			children[2] == nullptr && children[3] == nullptr) {
+		ReleaseSummary(node);
+		return;
+	}
+	if (node->summary == nullptr) {
+		node->summary = new(detail::BlocksAllocatorAdaptor<detail::NodeSummary<Number>>(allocator_)
+			.allocate(1)) detail::NodeSummary<Number>();
+	}
+	else if (node->summary->exact) {
+		return;
+	}
+	detail::NodeSummary<Number> summary;
+	detail::AddRecordsToSummary(node, &summary);
+	for (const detail::TreeNode<Number, Object>* child : children) {
+		if (child == nullptr) {
+			continue;
+		}
+		if (child->summary != nullptr) {
+			detail::MergeSummaries(&summary, *child->summary);
+			continue;
+		}
+		detail::AddRecordsToSummary(child, &summary);
+	}
+	assert(node->summary->count == 0 || node->summary->count == summary.count);
+	*node->summary = summary;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+RemoveFromSummaries(detail::TreeNode<Number, Object>* node,
+		const BoundingBox<Number>& object_bounds) {
+	// every summary above the record counts it, they are reached by the parent links
+	for (; node != nullptr; node = node->parent) {
+		if (node->summary != nullptr &&
+				detail::RemoveFromSummary(node->summary, object_bounds)) {
+			untidy_nodes_++; // left for the cleanup to shrink
+		}
+	}
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+MoveInSummaries(detail::TreeNode<Number, Object>* node,
+		const BoundingBox<Number>& old_bounds, const BoundingBox<Number>& new_bounds) {
+	// the counts stay, only the bounds can change: the upper summaries contain the lower
+	// ones, so above the first which holds both the old and the new bounds well inside
+	// nothing changes (for a small move it's mostly the parent of a leaf)
+	for (; node != nullptr; node = node->parent) {
+		detail::NodeSummary<Number>* summary = node->summary;
+		if (summary == nullptr) {
+			continue;
+		}
+		bool grows = !summary->bounds.Contains(new_bounds);
+		bool shrinks = detail::TouchesEdge(summary->bounds, old_bounds);
+		if (!grows && !shrinks) {
+			return;
+		}
+		if (grows) {
+			detail::UniteBounds(&summary->bounds, new_bounds);
+		}
+		if (shrinks && summary->exact) {
+			summary->exact = false;
+			untidy_nodes_++; // left for the cleanup to shrink
+		}
+	}
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+ReleaseSummary(detail::TreeNode<Number, Object>* node) {
+	if (node->summary != nullptr) {
+		detail::BlocksAllocatorAdaptor<detail::NodeSummary<Number>>(allocator_)
+			.deallocate(node->summary, 1);
+		node->summary = nullptr;
+	}
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+DeleteNode(detail::TreeNode<Number, Object>* node) {
+	ReleaseRecords(node);
+	ReleaseSummary(node);
+	allocator_.Delete(node);
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+int
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+TidyNode(detail::TreeNode<Number, Object>* node, int depth) {
+	// drops the removed records and shrinks the array, or relinks the objects of a node
+	// which got deeper than the maximal depth (the records of the queries are passed)
+	const int passed = node->size + 1;
+	if (depth <= maximal_depth_) {
+		CompactNode(node);
+		return passed;
+	}
+	// the objects go to upper nodes, so they are taken from the end of this one
+	while (node->size > 0) {
+		const typename detail::TreeNode<Number, Object>::Record record =
+			node->records[node->size - 1];
+		node->size--;
+		if (record.object == nullptr) {
+			removed_records_--;
+			continue;
+		}
+		ObjectHandle<Object>* place = object_handles_.Find(record.object);
+		RemoveFromSummaries(node, record.bounds);
+		InsertIntoTree(record.object, record.bounds, place);
+	}
+	ReleaseRecords(node);
+	return passed;
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+RaiseZOrder(detail::TreeNode<Number, Object>* node, unsigned long long z_order) {
+	// never lowered on removal, a stale summary only makes the pruning weaker
+	if (node->max_z_order < z_order) {
+		node->max_z_order = z_order;
+	}
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Impl::
+InsertIntoTree(Object* object, const BoundingBox<Number>& object_bounds,
+		ObjectHandle<Object>* place) {
+	Number object_center_x, object_center_y, maximal_object_extent;
+	GetObjectPlacement(object_bounds, &object_center_x, &object_center_y,
+		&maximal_object_extent);
+
+	if (root_ != nullptr) {
+		GrowRoot(object_center_x, object_center_y, maximal_object_extent);
 
 		detail::ForwardTreeTraversal<Number, Object> trav;
 		trav.StartAt(root_, bounding_box_);
+		unsigned long long path = 0;
+		unsigned long long z_order = ZOrderOf::Get(object);
 		do {
+			RaiseZOrder(trav.GetNode(), z_order);
 			const BoundingBox<Number>& node_bounds = trav.GetNodeBoundingBox();
 			assert(node_bounds.Contains(object_center_x, object_center_y));
 			Number maximal_bb_extent =
@@ -1280,7 +3280,7 @@ InsertIntoTree(Object* object) {
 			Number node_center_y = (Number)(node_bounds.top +
 				(Number)((typename detail::MakeDistance<Number>::Type)node_bounds.height / 2));
 
-			detail::TreeNode<Object>** direction;
+			detail::TreeNode<Number, Object>** direction;
 			if (object_center_x < node_center_x) {
 				if (object_center_y < node_center_y) {
 					direction = &trav.GetNode()->top_left;
@@ -1299,21 +3299,30 @@ InsertIntoTree(Object* object) {
 			}
 
 			if (*direction == nullptr) {
-				*direction = allocator_.New<detail::TreeNode<Object>>(allocator_);
+				*direction = allocator_.New<detail::TreeNode<Number, Object>>();
+				(*direction)->parent = trav.GetNode();
+				if (trav.GetNode()->summary == nullptr) {
+					RecalculateSummary(trav.GetNode()); // its first child, still empty
+				}
 			}
+			detail::AddToSummary(trav.GetNode()->summary, object_bounds);
 
 			if (*direction == trav.GetNode()->top_left) {
 				trav.GoTopLeft();
+				path = path << 2;
 			}
 			else if (*direction == trav.GetNode()->top_right) {
 				trav.GoTopRight();
+				path = path << 2 | 1;
 			}
 			else if (*direction == trav.GetNode()->bottom_right) {
 				trav.GoBottomRight();
+				path = path << 2 | 3;
 			}
 			else {
 				assert(*direction == trav.GetNode()->bottom_left);
 				trav.GoBottomLeft();
+				path = path << 2 | 2;
 			}
 		} while (true);
 
@@ -1330,190 +3339,356 @@ InsertIntoTree(Object* object) {
 		assert(effective_bounds.Contains(object_bounds));
 #endif
 
-		typename detail::TreeNode<Object>::ObjectContainer& objects =
-				trav.GetNode()->objects;
-		if (!objects.empty() && objects.front() == nullptr) {
-			objects.front() = object;
+		if (trav.GetNode()->summary != nullptr) {
+			detail::AddToSummary(trav.GetNode()->summary, object_bounds);
 		}
-		else {
-			objects.emplace_front(object);
-		}
-		return &objects.front();
+		place->slot = InsertIntoNode(trav.GetNode(), object, object_bounds);
+		place->node = trav.GetNode();
+		place->node_key = MakeNodeKey(path, trav.GetDepth());
 	}
 	else {
 		assert(number_of_objects_ == 0);
-		{
-			bounding_box_.width =
-				(Number)((typename detail::MakeDistance<Number>::Type)maximal_object_extent * 2 * 7 / 8);
-			bounding_box_.height = bounding_box_.width;
-			Number extent_half =
-				(Number)((typename detail::MakeDistance<Number>::Type)bounding_box_.width / 2);
-			bounding_box_.left = (Number)(object_center_x - extent_half);
-			bounding_box_.top = (Number)(object_center_y - extent_half);
-			assert(bounding_box_.left < bounding_box_.left + bounding_box_.width);
-			assert(bounding_box_.top < bounding_box_.top + bounding_box_.height);
-		}
-		root_ = allocator_.New<detail::TreeNode<Object>>(allocator_);
-		root_->objects.emplace_front(object);
-		return &root_->objects.front();
-	}
-}
-
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-auto
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Impl::
-GetAvailableQueryFromPool() -> typename Query::Impl* {
-	for (auto it = query_pool_.begin(); it != query_pool_.end(); it++) {
-		if (it->IsAvailable()) {
-			return &*it;
-		}
+		CreateRoot(object_center_x, object_center_y, maximal_object_extent);
+		RaiseZOrder(root_, ZOrderOf::Get(object));
+		place->slot = InsertIntoNode(root_, object, object_bounds);
+		place->node = root_;
+		place->node_key = MakeNodeKey(0, 0);
 	}
-	query_pool_.emplace_back();
-	assert(query_pool_.back().IsAvailable());
-	return &query_pool_.back();
 }
 
 
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
 Insert(Object* object) {
 	return impl_.Insert(object);
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename ForwardIterator>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+InsertBulk(ForwardIterator first, ForwardIterator last) {
+	impl_.InsertBulk(first, last);
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
 Update(Object* object) {
 	return impl_.Update(object);
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename ForwardIterator>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+UpdateBulk(ForwardIterator first, ForwardIterator last) {
+	impl_.UpdateBulk(first, last);
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
 Remove(Object* object) {
 	return impl_.Remove(object);
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
 Contains(Object* object) const {
 	return impl_.Contains(object);
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 auto
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
-QueryIntersectsRegion(const BoundingBox<Number>& region) -> Query {
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+QueryIntersectsRegion(const BoundingBox<Number>& region) const -> Query {
 	return impl_.QueryIntersectsRegion(region);
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 auto
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
-QueryInsideRegion(const BoundingBox<Number>& region) -> Query {
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+QueryInsideRegion(const BoundingBox<Number>& region) const -> Query {
 	return impl_.QueryInsideRegion(region);
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 auto
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
-QueryContainsRegion(const BoundingBox<Number>& region) -> Query {
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+QueryContainsRegion(const BoundingBox<Number>& region) const -> Query {
 	return impl_.QueryContainsRegion(region);
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+ForEachIntersecting(const BoundingBox<Number>& region, Visitor&& visitor) const {
+	return impl_.ForEachIntersecting(region, std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+ForEachContainingPoint(Number x, Number y, Visitor&& visitor) const {
+	return impl_.ForEachContainingPoint(x, y, std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+ForEachIntersectingMany(const BoundingBox<Number>* regions, int count, Visitor&& visitor) const {
+	return impl_.ForEachIntersectingMany(regions, count, std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+ForEachIntersectingPart(const BoundingBox<Number>& region, int part, int part_count,
+		Visitor&& visitor) const {
+	return impl_.ForEachIntersectingPart(region, part, part_count, std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor, typename SummaryVisitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+ForEachIntersectingCoarse(const BoundingBox<Number>& region, Number min_node_size,
+		Visitor&& visitor, SummaryVisitor&& summary_visitor) const {
+	return impl_.ForEachIntersectingCoarse(region, min_node_size, std::forward<Visitor>(visitor),
+		std::forward<SummaryVisitor>(summary_visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+ObjectT*
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+FindTopmostContainingPoint(Number x, Number y) const {
+	return impl_.FindTopmostContainingPoint(x, y);
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+ForEachNearest(Number x, Number y, Number max_distance, Visitor&& visitor) const {
+	return impl_.ForEachNearest(x, y, max_distance, std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+ForEachOnSegment(Number x1, Number y1, Number x2, Number y2, Visitor&& visitor) const {
+	return impl_.ForEachOnSegment(x1, y1, x2, y2, std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+template <typename Visitor>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+ForEachNode(const BoundingBox<Number>& region, Visitor&& visitor) const {
+	impl_.ForEachNode(region, std::forward<Visitor>(visitor));
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+auto
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+GetStatistics() const -> Statistics {
+	return impl_.GetStatistics();
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+int
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+CountIntersecting(const BoundingBox<Number>& region) const {
+	return impl_.CountIntersecting(region);
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+GetIntersectingBounds(const BoundingBox<Number>& region, BoundingBox<Number>* bounds) const {
+	return impl_.GetIntersectingBounds(region, bounds);
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 const BoundingBox<NumberT>&
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
 GetLooseBoundingBox() const {
 	return impl_.GetBoundingBox();
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 void
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
 ForceCleanup() {
 	impl_.ForceCleanup();
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+CleanupStep(int max_objects) {
+	return impl_.CleanupStep(max_objects);
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+bool
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+NeedsCleanup() const {
+	return impl_.NeedsCleanup();
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 int
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+GetRemovedCount() const {
+	return impl_.GetRemovedCount();
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+int
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
 GetSize() const {
 	return impl_.GetSize();
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
 IsEmpty() const {
 	return impl_.GetSize() == 0;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+long long
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+GetInPlaceUpdateCount() const {
+	return impl_.GetInPlaceUpdateCount();
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+long long
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+GetRelinkingUpdateCount() const {
+	return impl_.GetRelinkingUpdateCount();
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 void
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
+ResetUpdateCounters() {
+	impl_.ResetUpdateCounters();
+}
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+void
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::
 Clear() {
 	impl_.Clear();
 }
 
 
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::
-Query(Impl* pimpl) : pimpl_(pimpl) {
-	assert(pimpl_ != nullptr);
-	assert(!pimpl_->IsAvailable());
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::
+Query() {
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::
 ~Query() {
-	if (pimpl_ != nullptr) {
-		pimpl_->Release();
-		assert(pimpl_->IsAvailable());
-		pimpl_ = nullptr;
+	if (!impl_.IsAvailable()) {
+		impl_.Release();
+		assert(impl_.IsAvailable());
 	}
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::
-Query(Query&& other) : pimpl_(other.pimpl_) {
-	other.pimpl_ = nullptr;
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::
+Query(Query&& other) {
+	impl_.TakeOver(&other.impl_);
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 auto
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::
 operator=(Query&& other) -> Query& {
-	this->~Query();
-	pimpl_ = other.pimpl_;
-	other.pimpl_ = nullptr;
+	if (this != &other) {
+		if (!impl_.IsAvailable()) {
+			impl_.Release();
+		}
+		impl_.TakeOver(&other.impl_);
+	}
 	return *this;
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 bool
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::
 EndOfQuery() const {
-	return pimpl_->EndOfQuery();
+	return impl_.EndOfQuery();
 }
 
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 ObjectT*
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::
 GetCurrent() const {
-	return pimpl_->GetCurrent();
+	return impl_.GetCurrent();
 }
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT, typename ZOrderExtractorT>
 void
-	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT>::Query::
+	LooseQuadtree<NumberT, ObjectT, BoundingBoxExtractorT, ObjectHandleExtractorT, ZOrderExtractorT>::Query::
 Next() {
-	pimpl_->Next();
+	impl_.Next();
 }
 
 
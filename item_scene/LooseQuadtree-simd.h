@@ -0,0 +1,237 @@
+#ifndef LOOSEQUADTREE_LOOSEQUADTREE_SIMD_H
+#define LOOSEQUADTREE_LOOSEQUADTREE_SIMD_H
+
+#include "LooseQuadtree.h"
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+// The boxes of a node are tested against a region in batches, one bit of a mask each:
+// 64-bit integral coordinates use SSE2 on x86-64 (always there) and AVX2 when the
+// processor has it (checked once, at run time), everything else is tested one by one
+// with BoundingBox::Intersects(), define LQT_NO_SIMD to do that for every type
+#if !defined(LQT_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#define LQT_USE_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define LQT_USE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+namespace loose_quadtree {
+namespace detail {
+
+
+
+enum class BoxKernel {kScalar, kSse2, kAvx2};
+
+const int kMaskedBoxes = 64; ///< boxes tested at once at most, one bit of the mask each
+const int kFewBoxes = 4; ///< below this the vector kernels are not used
+
+
+
+inline BoxKernel FastestBoxKernel() {
+#if defined(LQT_USE_AVX2)
+	static const bool has_avx2 = __builtin_cpu_supports("avx2") != 0;
+	if (has_avx2) {
+		return BoxKernel::kAvx2;
+	}
+#endif
+#if defined(LQT_USE_SSE2)
+	return BoxKernel::kSse2;
+#else
+	return BoxKernel::kScalar;
+#endif
+}
+
+inline bool IsBoxKernelAvailable(BoxKernel kernel) {
+	switch (kernel) {
+	case BoxKernel::kScalar:
+		return true;
+	case BoxKernel::kSse2:
+		return FastestBoxKernel() != BoxKernel::kScalar;
+	case BoxKernel::kAvx2:
+		return FastestBoxKernel() == BoxKernel::kAvx2;
+	}
+	return false;
+}
+
+
+
+template <typename NumberT>
+unsigned long long IntersectingMaskScalar(const char* boxes, std::size_t stride, int count,
+		const BoundingBox<NumberT>& region) {
+	unsigned long long mask = 0;
+	for (int i = 0; i < count; i++) {
+		const BoundingBox<NumberT>& box =
+			*reinterpret_cast<const BoundingBox<NumberT>*>(boxes + i * stride);
+		mask |= (unsigned long long)region.Intersects(box) << i;
+	}
+	return mask;
+}
+
+
+
+inline unsigned long long IntersectingMaskFew(const char* boxes, std::size_t stride, int count,
+		long long left, long long top, long long right, long long bottom) {
+	// without branches, so the hits can't be mispredicted, but not worth a vector for a few boxes
+	unsigned long long mask = 0;
+	for (int i = 0; i < count; i++) {
+		const long long* box = reinterpret_cast<const long long*>(boxes + i * stride);
+		long long box_right = (long long)((unsigned long long)box[0] + (unsigned long long)box[2]);
+		long long box_bottom = (long long)((unsigned long long)box[1] + (unsigned long long)box[3]);
+		mask |= (unsigned long long)((box_right > left) & (right > box[0]) &
+			(box_bottom > top) & (bottom > box[1])) << i;
+	}
+	return mask;
+}
+
+
+
+#if defined(LQT_USE_SSE2)
+
+inline __m128i GreaterThanEpi64Sse2(__m128i a, __m128i b) {
+	// SSE2 compares 32 bits at most: the high halves signed, and where those are equal
+	// the low halves unsigned (by flipping their sign bits)
+	const __m128i flip = _mm_set_epi32(0, (int)0x80000000u, 0, (int)0x80000000u);
+	a = _mm_xor_si128(a, flip);
+	b = _mm_xor_si128(b, flip);
+	__m128i greater = _mm_cmpgt_epi32(a, b);
+	__m128i equal = _mm_cmpeq_epi32(a, b);
+	__m128i high_greater = _mm_shuffle_epi32(greater, _MM_SHUFFLE(3, 3, 1, 1));
+	__m128i high_equal = _mm_shuffle_epi32(equal, _MM_SHUFFLE(3, 3, 1, 1));
+	__m128i low_greater = _mm_shuffle_epi32(greater, _MM_SHUFFLE(2, 2, 0, 0));
+	return _mm_or_si128(high_greater, _mm_and_si128(high_equal, low_greater));
+}
+
+inline unsigned long long IntersectingMaskSse2(const char* boxes, std::size_t stride, int count,
+		long long left, long long top, long long right, long long bottom) {
+	// a box at a time: its left-top and right-bottom against the region's right-bottom and left-top
+	const __m128i region_near = _mm_set_epi64x(top, left);
+	const __m128i region_far = _mm_set_epi64x(bottom, right);
+	unsigned long long mask = 0;
+	for (int i = 0; i < count; i++) {
+		const char* box = boxes + i * stride;
+		__m128i near = _mm_loadu_si128(reinterpret_cast<const __m128i*>(box));
+		__m128i size = _mm_loadu_si128(reinterpret_cast<const __m128i*>(box + 2 * sizeof(long long)));
+		__m128i far = _mm_add_epi64(near, size);
+		__m128i hits = _mm_and_si128(GreaterThanEpi64Sse2(far, region_near),
+			GreaterThanEpi64Sse2(region_far, near));
+		mask |= (unsigned long long)(_mm_movemask_pd(_mm_castsi128_pd(hits)) == 3) << i;
+	}
+	return mask;
+}
+
+#endif
+
+#if defined(LQT_USE_AVX2)
+
+__attribute__((target("avx2")))
+inline unsigned long long IntersectingMaskAvx2(const char* boxes, std::size_t stride, int count,
+		long long left, long long top, long long right, long long bottom) {
+	// four boxes at a time, turned from left-top-width-height rows into columns
+	const __m256i region_left = _mm256_set1_epi64x(left);
+	const __m256i region_top = _mm256_set1_epi64x(top);
+	const __m256i region_right = _mm256_set1_epi64x(right);
+	const __m256i region_bottom = _mm256_set1_epi64x(bottom);
+	const __m256i region_near = _mm256_set_epi64x(top, left, top, left);
+	const __m256i region_far = _mm256_set_epi64x(bottom, right, bottom, right);
+	unsigned long long mask = 0;
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const char* box = boxes + i * stride;
+		__m256i box0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(box));
+		__m256i box1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(box + stride));
+		__m256i box2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(box + 2 * stride));
+		__m256i box3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(box + 3 * stride));
+		__m256i lefts_widths01 = _mm256_unpacklo_epi64(box0, box1);
+		__m256i tops_heights01 = _mm256_unpackhi_epi64(box0, box1);
+		__m256i lefts_widths23 = _mm256_unpacklo_epi64(box2, box3);
+		__m256i tops_heights23 = _mm256_unpackhi_epi64(box2, box3);
+		__m256i lefts = _mm256_permute2x128_si256(lefts_widths01, lefts_widths23, 0x20);
+		__m256i widths = _mm256_permute2x128_si256(lefts_widths01, lefts_widths23, 0x31);
+		__m256i tops = _mm256_permute2x128_si256(tops_heights01, tops_heights23, 0x20);
+		__m256i heights = _mm256_permute2x128_si256(tops_heights01, tops_heights23, 0x31);
+		__m256i hits_x = _mm256_and_si256(
+			_mm256_cmpgt_epi64(_mm256_add_epi64(lefts, widths), region_left),
+			_mm256_cmpgt_epi64(region_right, lefts));
+		__m256i hits_y = _mm256_and_si256(
+			_mm256_cmpgt_epi64(_mm256_add_epi64(tops, heights), region_top),
+			_mm256_cmpgt_epi64(region_bottom, tops));
+		__m256i hits = _mm256_and_si256(hits_x, hits_y);
+		mask |= (unsigned long long)_mm256_movemask_pd(_mm256_castsi256_pd(hits)) << i;
+	}
+	for (; i < count; i++) {
+		// the rest one by one: right-bottom and the region's right-bottom against
+		// the region's left-top and left-top in one compare
+		__m256i box = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(boxes + i * stride));
+		__m256i near = _mm256_permute4x64_epi64(box, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256i far = _mm256_add_epi64(near, _mm256_permute4x64_epi64(box, _MM_SHUFFLE(3, 2, 3, 2)));
+		__m256i hits = _mm256_cmpgt_epi64(_mm256_blend_epi32(far, region_far, 0xf0),
+			_mm256_blend_epi32(region_near, near, 0xf0));
+		mask |= (unsigned long long)(_mm256_movemask_pd(_mm256_castsi256_pd(hits)) == 0xf) << i;
+	}
+	return mask;
+}
+
+#endif
+
+
+
+template <typename NumberT, typename Enable = void>
+struct IntersectingMaskOf {
+	static unsigned long long Get(BoxKernel, const char* boxes, std::size_t stride, int count,
+			const BoundingBox<NumberT>& region) {
+		return IntersectingMaskScalar(boxes, stride, count, region);
+	}
+};
+
+#if defined(LQT_USE_SSE2)
+
+template <typename NumberT>
+struct IntersectingMaskOf<NumberT, typename std::enable_if<std::is_integral<NumberT>::value &&
+		std::is_signed<NumberT>::value && sizeof(NumberT) == sizeof(long long)>::type> {
+	static unsigned long long Get(BoxKernel kernel, const char* boxes, std::size_t stride, int count,
+			const BoundingBox<NumberT>& region) {
+		// the far sides wrap around like the sums of BoundingBox::Intersects() do (and the
+		// ones of the boxes in the kernels), but without the overflow of signed numbers
+		long long left = (long long)region.left;
+		long long top = (long long)region.top;
+		long long right = (long long)((unsigned long long)left + (unsigned long long)region.width);
+		long long bottom = (long long)((unsigned long long)top + (unsigned long long)region.height);
+		if (count < kFewBoxes && kernel != BoxKernel::kScalar) {
+			return IntersectingMaskFew(boxes, stride, count, left, top, right, bottom);
+		}
+		switch (kernel) {
+#if defined(LQT_USE_AVX2)
+		case BoxKernel::kAvx2:
+			return IntersectingMaskAvx2(boxes, stride, count, left, top, right, bottom);
+#endif
+		case BoxKernel::kSse2:
+			return IntersectingMaskSse2(boxes, stride, count, left, top, right, bottom);
+		default:
+			return IntersectingMaskScalar(boxes, stride, count, region);
+		}
+	}
+};
+
+#endif
+
+template <typename NumberT>
+unsigned long long IntersectingMask(const BoundingBox<NumberT>* first, std::size_t stride,
+		int count, const BoundingBox<NumberT>& region, BoxKernel kernel = FastestBoxKernel()) {
+	// bit i is set if the box at first + i * stride (in bytes) intersects the region
+	assert(count >= 0 && count <= kMaskedBoxes);
+	assert(IsBoxKernelAvailable(kernel));
+	return IntersectingMaskOf<NumberT>::Get(kernel, reinterpret_cast<const char*>(first), stride,
+		count, region);
+}
+
+
+
+} //detail
+} //loose_quadtree
+
+#endif //LOOSEQUADTREE_LOOSEQUADTREE_SIMD_H
@@ -15,23 +15,44 @@
  * - Gives theoretically optimal search results (see previous)
  * - Uses tree structure instead of hashed (smaller memory footprint, cache friendly)
  * - Uses as much data in-place as it can (by using its own allocator)
+ * - Nodes keep their objects in arrays along with copies of their bounding boxes,
+ *     so searches read contiguous memory and touch an object only when it's found
+ * - Tests the records of a node against a region in batches with SSE2/AVX2 on x86-64
  * - Allocates memory in big chunks
  * - Uses axis-aligned bounding boxes for calculations
  * - Uses left-top-width-height bounds for better precision (no right-bottom)
  * - Uses left-top closed right-bottom open interval logic (for integral types)
  * - Uses X-towards-right Y-towards-bottom screen-like coordinate system
  * - It is suitable for both floating- and fixed-point logic
- * - This library is not thread-safe but multiple queries can be run at once
+ * - Nodes with children keep the count and the bounds of their subtree, so the subtrees inside
+ *     of a region are counted without touching their objects (CountIntersecting())
+ * - Removal unlinks the record at once (the last one of the node takes its place), so the
+ *     searches only read the tree, empty nodes and oversized arrays wait for a cleanup
+ * - This library is not thread-safe, but the queries only read the tree and allocate nothing,
+ *     so several of them can run at once (from several threads too while nothing changes the tree)
  *
  * Generic parameters are:
  * - NumberT generic number type allows its floating- and fixed-point usage
  * - ObjectT* only pointer is stored, no object copying is done, not an inclusive container
  * - BoundingBoxExtractorT allows using your own bounding box type/source, needs
  *     BoundingBoxExtractor::ExtractBoundingBox(ObjectT* in, BoundingBox<Number>* out) implemented
+ *     (the box is copied on Insert() and Update(), call Update() whenever it changes)
+ * - ObjectHandleExtractorT (optional) keeps the place of the objects inside the objects
+ *     instead of a hash map, needs
+ *     ObjectHandleExtractor::ExtractObjectHandle(ObjectT* in) -> ObjectHandle<ObjectT>* implemented
+ *     (such an object can be stored in one tree at a time)
+ * - ZOrderExtractorT (optional) orders the objects for FindTopmostContainingPoint(), needs
+ *     ZOrderExtractor::ExtractZOrder(const ObjectT* in) -> unsigned long long implemented
+ *     (the order of an object must not grow while it is in the tree, remove it first)
  */
 
 
 
+#include <cstddef>
+#include <vector>
+
+
+
 namespace loose_quadtree {
 
 
@@ -54,12 +75,28 @@ struct BoundingBox {
 
 
 
-template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT>
+template <typename ObjectT>
+struct ObjectHandle {
+	using Object = ObjectT;
+
+	ObjectHandle() : slot(nullptr), node(nullptr), node_key(0) {}
+
+	Object** slot; ///< in the records of the node (moves with them), nullptr if not in the tree
+	void* node; ///< the node of the slot, so a removal unlinks the record without a search
+	unsigned long long node_key; ///< identifies the node of the slot by its path
+};
+
+
+
+template <typename NumberT, typename ObjectT, typename BoundingBoxExtractorT,
+	typename ObjectHandleExtractorT = void, typename ZOrderExtractorT = void>
 class LooseQuadtree {
 public:
 	using Number = NumberT;
 	using Object = ObjectT;
 	using BoundingBoxExtractor = BoundingBoxExtractorT;
+	using ObjectHandleExtractor = ObjectHandleExtractorT;
+	using ZOrderExtractor = ZOrderExtractorT;
 
 private:
 	class Impl;
@@ -68,7 +105,6 @@ public:
 	class Query {
 	public:
 		~Query();
-		Query() = delete;
 		Query(const Query&) = delete;
 		Query& operator=(const Query&) = delete;
 		Query(Query&&);
@@ -79,10 +115,29 @@ public:
 		void Next();
 
 	private:
-		friend class LooseQuadtree<Number, Object, BoundingBoxExtractor>::Impl;
+		friend class LooseQuadtree<Number, Object, BoundingBoxExtractor,
+			ObjectHandleExtractor, ZOrderExtractor>::Impl;
 		class Impl;
-		Query(Impl* pimpl);
-		Impl* pimpl_;
+		Query();
+		Impl impl_; ///< holds the traversal stack too, a query allocates nothing
+	};
+
+	struct Statistics {
+		Statistics() : node_count(0), object_count(0), removed_records(0),
+			max_objects_per_node(0), average_objects_per_node(0.0),
+			used_blocks(0), free_blocks(0), maximal_depth(0), loose_bounds(0, 0, 0, 0) {}
+
+		std::vector<int> nodes_per_depth; ///< indexed by the depth, the root is at 0
+		std::vector<int> objects_per_depth; ///< by the depth of their nodes
+		int node_count;
+		int object_count;
+		int removed_records; ///< see GetRemovedCount()
+		int max_objects_per_node;
+		double average_objects_per_node; ///< of all the nodes, empty ones included
+		std::size_t used_blocks; ///< blocks of the own allocator with slots in use
+		std::size_t free_blocks; ///< blocks of the own allocator a cleanup would give back
+		int maximal_depth; ///< the objects go this deep at most, deeper nodes wait for a cleanup
+		BoundingBox<Number> loose_bounds; ///< see GetLooseBoundingBox()
 	};
 
 	LooseQuadtree() {}
@@ -91,19 +146,84 @@ public:
 	LooseQuadtree& operator=(const LooseQuadtree&) = delete;
 
 	bool Insert(Object* object); ///< true if it was inserted (else updated)
+	template <typename ForwardIterator>
+	void InsertBulk(ForwardIterator first, ForwardIterator last);
+	///< same as Insert() on every object of the range, but builds the tree in one pass
 	bool Update(Object* object); ///< true if it was updated (else inserted)
+	///< objects which still belong to the same node are not relinked, only checked
+	template <typename ForwardIterator>
+	void UpdateBulk(ForwardIterator first, ForwardIterator last);
+	///< same as Update() on every object of the range, the unknown ones are inserted at once
 	bool Remove(Object* object); ///< true if it was removed
 	bool Contains(Object* object) const; ///< true if object is in tree
-	Query QueryIntersectsRegion(const BoundingBox<Number>& region);
-	Query QueryInsideRegion(const BoundingBox<Number>& region);
-	Query QueryContainsRegion(const BoundingBox<Number>& region);
+	Query QueryIntersectsRegion(const BoundingBox<Number>& region) const;
+	Query QueryInsideRegion(const BoundingBox<Number>& region) const;
+	Query QueryContainsRegion(const BoundingBox<Number>& region) const;
+	template <typename Visitor>
+	bool ForEachIntersecting(const BoundingBox<Number>& region, Visitor&& visitor) const;
+	///< calls visitor(object) on what QueryIntersectsRegion() would find, stops when it returns
+	///< false (then returns false too), does no cleanup so it can run inside of queries
+	template <typename Visitor>
+	bool ForEachContainingPoint(Number x, Number y, Visitor&& visitor) const;
+	///< same as ForEachIntersecting() for the objects which contain the point
+	template <typename Visitor>
+	bool ForEachIntersectingMany(const BoundingBox<Number>* regions, int count,
+		Visitor&& visitor) const;
+	///< same as ForEachIntersecting() on every region with visitor(object, region_index),
+	///< in one walk of the tree (per 64 regions), the common upper nodes are checked once
+	template <typename Visitor>
+	bool ForEachIntersectingPart(const BoundingBox<Number>& region, int part, int part_count,
+		Visitor&& visitor) const;
+	///< same as ForEachIntersecting() on one of part_count disjoint parts of the result, so the
+	///< parts can be walked from several threads at once while nothing changes the tree
+	template <typename Visitor, typename SummaryVisitor>
+	bool ForEachIntersectingCoarse(const BoundingBox<Number>& region, Number min_node_size,
+		Visitor&& visitor, SummaryVisitor&& summary_visitor) const;
+	///< same as ForEachIntersecting() above the nodes narrower than min_node_size, each of those
+	///< is given at once as summary_visitor(node_bounds, object_count, objects_bounds) for its
+	///< whole subtree (out of the region too), for drawing a level of detail by the node summaries
+	Object* FindTopmostContainingPoint(Number x, Number y) const;
+	///< the object with the highest z-order which contains the point (nullptr if none),
+	///< skips the subtrees which can't have a higher one than the best so far
+	template <typename Visitor>
+	bool ForEachNearest(Number x, Number y, Number max_distance, Visitor&& visitor) const;
+	///< calls visitor(object) by the growing distance between the point and the bounding boxes
+	///< (zero inside), skips the farther than max_distance, stops like ForEachIntersecting()
+	template <typename Visitor>
+	bool ForEachOnSegment(Number x1, Number y1, Number x2, Number y2, Visitor&& visitor) const;
+	///< calls visitor(object) on the objects crossed by the segment in the order the segment
+	///< enters them (use a far end point for a ray), stops like ForEachIntersecting()
+	template <typename Visitor>
+	void ForEachNode(const BoundingBox<Number>& region, Visitor&& visitor) const;
+	///< calls visitor(node_bounds, depth, object_count) on the nodes which area intersects the
+	///< region (the objects of a node may reach out of it by half its size), parents first,
+	///< the children of a node are visited only if it returns true
+	Statistics GetStatistics() const; ///< walks the whole tree, meant for diagnostics
+	int CountIntersecting(const BoundingBox<Number>& region) const;
+	///< the number of objects ForEachIntersecting() would visit, the subtrees inside of the
+	///< region are counted by the summaries of their nodes without touching the objects
+	bool GetIntersectingBounds(const BoundingBox<Number>& region,
+		BoundingBox<Number>* bounds) const;
+	///< the bounding box of those objects (false if none), also from the summaries as long as
+	///< removals haven't left them too big (then only until the next cleanup pass)
 	const BoundingBox<Number>& GetLooseBoundingBox() const;
 	///< double its size to get a bounding box including everything contained for sure
 	int GetSize() const;
 	bool IsEmpty() const;
 	void Clear();
 	void ForceCleanup(); ///< does a full data structure and memory cleanup
-	///< cleanup is semi-automatic during queries so you needn't call this normally
+	///< prunes the nodes emptied by removals, shrinks the arrays and gives back the memory,
+	///< does nothing while queries are open
+	bool CleanupStep(int max_objects); ///< true when there's nothing more to clean up
+	///< does a part of ForceCleanup() (passing max_objects records at most, or releasing the
+	///< free memory of one size class after the pass) and goes on with it on the next call, so
+	///< it can be spread over idle times (returns true at once while queries are open)
+	bool NeedsCleanup() const; ///< true if removals left something for a cleanup
+	int GetRemovedCount() const; ///< objects removed while queries were open, which records
+	///< stay in the tree (skipped by the searches) until a cleanup
+	long long GetInPlaceUpdateCount() const; ///< Update() calls which stayed in their node
+	long long GetRelinkingUpdateCount() const; ///< Update() calls which moved to another node
+	void ResetUpdateCounters();
 
 private:
 	Impl impl_;
@@ -7,40 +7,95 @@
 #include <QPaintEvent>
 #include <QKeyEvent>
 #include <QMessageBox>
+#include <QElapsedTimer>
 #include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
 
 #include "pge_edit_scene.h"
+#include "pge_quad_tree.h"
+#include "pge_tile_grid.h"
+#include "pge_packed_rtree.h"
+
+//! Rectangle selections larger than this area are searched on several threads
+static const int64_t c_parallelSelectionArea = 4096ll * 4096ll;
+//! Milliseconds without the user's input before the index gets optimized
+static const int c_indexIdleDelay = 2000;
+//! Milliseconds of one index compaction slice, the rest of the event loop goes on between them
+static const int c_indexCompactSlice = 4;
+//! Elements passed by one compaction step, the slice is checked between the steps
+static const int c_indexCompactBatch = 4096;
+//! Nodes of the index overlay with this many elements are drawn red, emptier ones go to green
+static const int c_indexNodeFullCount = 64;
+//! Nodes of the index overlay smaller than this on the screen (in pixels) are not split further
+static const double c_indexNodeMinSize = 8.0;
+//! Level of detail cells with this many elements per square pixel are drawn black, emptier ones lighter
+static const double c_lodFullDensity = 0.25;
+
+static void sortByZOrder(PGE_EditScene::PGE_EditItemList &list)
+{
+    std::sort(list.begin(), list.end(), [](const PGE_EditSceneItem *a, const PGE_EditSceneItem *b)
+    {
+        return a->zOrder() < b->zOrder();
+    });
+}
 
-PGE_EditScene::PGE_EditScene(QWidget *parent) :
+PGE_EditScene::PGE_EditScene(QWidget *parent, IndexBackend index) :
     QWidget(parent),
     m_mouseMoved(false),
     m_ignoreMove(false),
     m_ignoreRelease(false),
     m_moveInProcess(false),
+    m_moveOffsetX(0),
+    m_moveOffsetY(0),
     m_rectSelect(false),
     m_zoom(1.0),
-    m_isBusy(m_busyMutex, std::defer_lock),
+    m_busyIsClosing(false),
+    m_isBusy(false),
+    m_isLoading(false),
     m_abortThread(false)
 {
+    if(index == IndexTileGrid)
+        m_tree.reset(new PgeTileGrid);
+    else if(index == IndexPackedRTree)
+        m_tree.reset(new PgePackedRTree);
+    else
+        m_tree.reset(new PgeQuadTree);
     setFocusPolicy(Qt::StrongFocus);
     setMouseTracking(true);
     connect(&m_mover.timer,
             &QTimer::timeout,
             this,
             static_cast<void (PGE_EditScene::*)()>(&PGE_EditScene::moveCamera));
+    m_indexIdleTimer.setSingleShot(true);
+    m_indexIdleTimer.setInterval(c_indexIdleDelay);
+    connect(&m_indexIdleTimer,
+            &QTimer::timeout,
+            this,
+            &PGE_EditScene::optimizeIndex);
+    m_indexCompactTimer.setInterval(0);
+    connect(&m_indexCompactTimer,
+            &QTimer::timeout,
+            this,
+            &PGE_EditScene::compactIndexStep);
 }
 
 PGE_EditScene::~PGE_EditScene()
 {
-    m_tree.clearAndDestroy();
+    m_tree->clearAndDestroy();
 }
 
 PGE_EditSceneItem *PGE_EditScene::addRect(int64_t x, int64_t y)
+{
+    PGE_EditSceneItem *item = createRect(x, y);
+    registerElement(item);
+    return item;
+}
+
+PGE_EditSceneItem *PGE_EditScene::createRect(int64_t x, int64_t y)
 {
     PGE_EditSceneItem *item = new PGE_EditSceneItem(this);
     item->m_posRect.setRect(x, y, 32, 32);
     item->setPos(x, y);
-    registerElement(item);
     return item;
 }
 
@@ -54,10 +109,16 @@ void PGE_EditScene::clearSelection()
 
 void PGE_EditScene::moveSelection(int64_t deltaX, int64_t deltaY)
 {
-    for(PGE_EditSceneItem *item : m_selectedItems)
+    if(m_moveInProcess)
     {
-        item->m_posRect.moveBy(deltaX, deltaY);
-        updateElement(item);
+        // Elements are floating until moving end, tree will be updated once
+        m_moveOffsetX += deltaX;
+        m_moveOffsetY += deltaY;
+    }
+    else
+    {
+        m_tree->updateMany(m_selectedItems, deltaX, deltaY);
+        scheduleIndexOptimize();
     }
     m_selectionRect.moveBy(deltaX, deltaY);
 }
@@ -83,6 +144,18 @@ void PGE_EditScene::captureSelectionRect()
     }
 }
 
+PGE_Rect<int64_t> PGE_EditScene::rectSelectionZone(const QPointF &end) const
+{
+    qreal left   = m_mouseBegin.x() < end.x() ? m_mouseBegin.x() : end.x();
+    qreal right  = m_mouseBegin.x() > end.x() ? m_mouseBegin.x() : end.x();
+    qreal top    = m_mouseBegin.y() < end.y() ? m_mouseBegin.y() : end.y();
+    qreal bottom = m_mouseBegin.y() > end.y() ? m_mouseBegin.y() : end.y();
+
+    PGE_Rect<int64_t> zone;
+    zone.setCoords(D_TO_INT64(left), D_TO_INT64(top), D_TO_INT64(right), D_TO_INT64(bottom));
+    return zone;
+}
+
 void PGE_EditScene::select(PGE_EditSceneItem &item)
 {
     item.m_selected = true;
@@ -113,29 +186,64 @@ void PGE_EditScene::setItemSelected(PGE_EditSceneItem &item, bool selected)
         m_selectedItems.remove(&item);
 }
 
+void PGE_EditScene::setItemLayer(PGE_EditSceneItem &item, int layer)
+{
+    // The tree doesn't allow raising the order of a registered element, so it gets registered again
+    bool registered = m_tree->remove(&item);
+    item.m_zLayer = layer;
+    if(registered)
+        registerElement(&item);
+}
+
+void PGE_EditScene::moveSelectionLayer(int delta)
+{
+    for(PGE_EditSceneItem *item : m_selectedItems)
+        setItemLayer(*item, item->zLayer() + delta);
+}
+
 void PGE_EditScene::moveStart()
 {
     m_moveInProcess = true;
+    m_moveOffsetX = 0;
+    m_moveOffsetY = 0;
 }
 
-void PGE_EditScene::moveEnd(bool /*esc*/)
+void PGE_EditScene::moveEnd(bool esc)
 {
     m_moveInProcess = false;
+    if(esc)
+    {
+        // Elements are still at their initial positions, just drop the offset
+        m_selectionRect.moveBy(-m_moveOffsetX, -m_moveOffsetY);
+        clearSelection();
+    }
+    else if((m_moveOffsetX != 0) || (m_moveOffsetY != 0))
+    {
+        m_tree->updateMany(m_selectedItems, m_moveOffsetX, m_moveOffsetY);
+        scheduleIndexOptimize();
+    }
+    m_moveOffsetX = 0;
+    m_moveOffsetY = 0;
 }
 
 void PGE_EditScene::startInitAsync()
 {
     m_busyMessage = tr("Loading...");
     m_busyIsClosing = false;
-    m_isBusy.lock();
-    QtConcurrent::run<void>(this, &PGE_EditScene::initThread);
+    m_isBusy = true;
+    m_isLoading = true;
+    m_busyThread = QtConcurrent::run<void>(this, &PGE_EditScene::initThread);
 }
 
 void PGE_EditScene::initThread()
 {
-    if(!m_isBusy.owns_lock())
-        m_isBusy.lock();
+    m_isBusy = true;
 
+    // Rows are published in chunks, the loaded part can be browsed while the rest is loading
+    const int rowsPerChunk = 16;
+    PGE_EditItemList chunk;
+    chunk.reserve(rowsPerChunk * ((32000 + 1024) / 32));
+    int rows = 0;
     bool offset = false;
     for(int y = -1024; y < 32000; y += 32)
     {
@@ -145,79 +253,176 @@ void PGE_EditScene::initThread()
         {
             if(m_abortThread)
                 break;
-            addRect(x,  y + (offset ? 16 : 0));
+            chunk.push_back(createRect(x,  y + (offset ? 16 : 0)));
             offset = !offset;
         }
+        if(++rows % rowsPerChunk == 0)
+        {
+            registerElements(chunk);
+            chunk.clear();
+            metaObject()->invokeMethod(this, "update", Qt::QueuedConnection);
+        }
     }
+    // Even when aborted, created items must be registered to be destroyed together with the tree
+    registerElements(chunk);
 
-    m_isBusy.unlock();
+    m_isLoading = false;
+    m_isBusy = false;
     metaObject()->invokeMethod(this, "repaint", Qt::QueuedConnection);
+    // The timers belong to the GUI thread, the compaction stopped itself if elements were removed meanwhile
+    metaObject()->invokeMethod(&m_indexIdleTimer, "start", Qt::QueuedConnection);
+    metaObject()->invokeMethod(this, "scheduleIndexCompact", Qt::QueuedConnection);
 }
 
 void PGE_EditScene::startDeInitAsync()
 {
     m_busyMessage = tr("Closing...");
     m_busyIsClosing = true;
-    m_isBusy.lock();
-    QtConcurrent::run<void>(this, &PGE_EditScene::deInitThread);
+    m_isBusy = true;
+    m_busyThread = QtConcurrent::run<void>(this, &PGE_EditScene::deInitThread);
 }
 
 void PGE_EditScene::deInitThread()
 {
-    if(!m_isBusy.owns_lock())
-        m_isBusy.lock();
+    m_isBusy = true;
     metaObject()->invokeMethod(this, "repaint", Qt::QueuedConnection);
 
-    m_tree.clearAndDestroy();
+    m_tree->clearAndDestroy();
 
     m_busyIsClosing = false;
-    m_isBusy.unlock();
+    m_isBusy = false;
     metaObject()->invokeMethod(this->parent(), "close", Qt::QueuedConnection);
 }
 
-struct _TreeSearchQuery
+bool PGE_EditScene::isBusy() const
+{
+    return m_isBusy && !m_isLoading;
+}
+
+void PGE_EditScene::scheduleIndexOptimize()
+{
+    if(m_tree->needsOptimize())
+        m_indexIdleTimer.start();
+    scheduleIndexCompact();
+}
+
+void PGE_EditScene::scheduleIndexCompact()
+{
+    if(!m_indexCompactTimer.isActive() && m_tree->needsCompact())
+        m_indexCompactTimer.start();
+}
+
+void PGE_EditScene::postponeIndexOptimize()
+{
+    if(m_indexIdleTimer.isActive())
+        m_indexIdleTimer.start();
+}
+
+void PGE_EditScene::optimizeIndex()
 {
-    PGE_EditScene::PGE_EditItemList *list;
-    PGE_Rect<int64_t> *zone;
-};
+    if(m_isBusy || m_moveInProcess || m_rectSelect)
+    {
+        m_indexIdleTimer.start();
+        return;
+    }
+    if(m_tree->needsOptimize())
+        m_tree->optimize();
+}
 
-static bool _TreeSearchCallback(PGE_EditSceneItem *item, void *arg)
+void PGE_EditScene::compactIndexStep()
 {
-    _TreeSearchQuery* ar = static_cast<_TreeSearchQuery *>(arg);
-    PGE_EditScene::PGE_EditItemList *list = ar->list;
-    if(list && item)
+    // Scheduled again at the end of the loading, the tree isn't ours until then
+    if(m_isBusy)
     {
-        (*list).push_back(item);
+        m_indexCompactTimer.stop();
+        return;
     }
-    return true;
+    QElapsedTimer slice;
+    slice.start();
+    bool done;
+    do
+    {
+        done = m_tree->compactStep(c_indexCompactBatch);
+    }
+    while(!done && slice.elapsed() < c_indexCompactSlice);
+    if(done)
+        m_indexCompactTimer.stop();
+}
+
+void PGE_EditScene::toggleIndexNodes()
+{
+    m_showIndexNodes = !m_showIndexNodes;
+    update();
+}
+
+void PGE_EditScene::drawIndexNodes(QPainter *painter, const PGE_Rect<int64_t> &zone)
+{
+    const PgeQuadTree *tree = dynamic_cast<const PgeQuadTree *>(m_tree.get());
+    if(!tree)
+        return; // Other backends have no nodes to show
+    const double minSize = c_indexNodeMinSize / m_zoom;
+    painter->save();
+    painter->setBrush(Qt::NoBrush);
+    tree->queryNodes(zone, [painter, minSize](const PGE_Rect<int64_t> &nodeRect, int /*depth*/, int itemsCount)
+    {
+        QColor color(Qt::gray);
+        if(itemsCount > 0)
+        {
+            double fill = std::min(1.0, double(itemsCount) / c_indexNodeFullCount);
+            color = QColor::fromHsvF((1.0 - fill) / 3.0, 1.0, 0.9);
+        }
+        QPen pen(color);
+        pen.setCosmetic(true); // One pixel at any zoom
+        painter->setPen(pen);
+        painter->drawRect(QRectF(nodeRect.x(), nodeRect.y(), nodeRect.width(), nodeRect.height()));
+        // Children are a half of the node, too small ones would cover everything by lines
+        return nodeRect.width() / 2 >= minSize;
+    });
+    painter->restore();
+}
+
+void PGE_EditScene::setLodCellSize(double pixels)
+{
+    m_lodCellSize = pixels;
+    update();
+}
+
+void PGE_EditScene::toggleLod()
+{
+    m_lodEnabled = !m_lodEnabled;
+    update();
 }
 
 void PGE_EditScene::queryItems(PGE_Rect<int64_t> &zone, PGE_EditScene::PGE_EditItemList *resultList)
 {
-    _TreeSearchQuery query = {resultList, &zone};
-    m_tree.query(zone, _TreeSearchCallback, (void*)&query);
+    m_tree->query(zone, resultList);
 }
 
 void PGE_EditScene::queryItems(int64_t x, int64_t y, PGE_EditScene::PGE_EditItemList *resultList)
 {
     PGE_Rect<int64_t> z(x, y, 1, 1);
-    _TreeSearchQuery query = {resultList, &z};
-    m_tree.query(z, _TreeSearchCallback, (void*)&query);
+    m_tree->query(z, resultList);
 }
 
 void PGE_EditScene::registerElement(PGE_EditSceneItem *item)
 {
-    m_tree.insert(item);
+    m_tree->insert(item);
+    scheduleIndexOptimize();
+}
+
+void PGE_EditScene::registerElements(const PGE_EditScene::PGE_EditItemList &items)
+{
+    m_tree->insertBulk(items);
 }
 
 void PGE_EditScene::updateElement(PGE_EditSceneItem *item)
 {
-    m_tree.update(item);
+    m_tree->update(item);
 }
 
 void PGE_EditScene::unregisterElement(PGE_EditSceneItem *item)
 {
-    m_tree.remove(item);
+    m_tree->remove(item);
 }
 
 
@@ -251,15 +456,17 @@ void PGE_EditScene::deleteItem(PGE_EditSceneItem *item)
         m_selectedItems.remove(item);
         m_selectionRect.reset();
     }
-    m_tree.removeAndDestroy(item);
+    m_tree->removeAndDestroy(item);
+    scheduleIndexOptimize();
 }
 
 void PGE_EditScene::deleteSelectedItems()
 {
     for(PGE_EditSceneItem *item : m_selectedItems)
-        m_tree.removeAndDestroy(item);
+        m_tree->removeAndDestroy(item);
     m_selectedItems.clear();
     m_selectionRect.reset();
+    scheduleIndexOptimize();
 }
 
 bool PGE_EditScene::mouseOnScreen()
@@ -363,34 +570,27 @@ void PGE_EditScene::moveCameraTo(int64_t x, int64_t y)
 
 bool PGE_EditScene::selectOneAt(int64_t x, int64_t y, bool isCtrl)
 {
-    bool catched = false;
-    PGE_EditItemList list;
-    queryItems(x, y, &list);
-    for(PGE_EditSceneItem *item : list)
+    PGE_EditSceneItem *item = m_tree->queryPoint(x, y);
+    if(!item)
+        return false;
+
+    if(isCtrl)
     {
-        if(item->isTouching(x, y))
-        {
-            catched = true;
-            if(isCtrl)
-            {
-                toggleselect(*item);
-            }
-            else if(!item->selected())
-            {
-                clearSelection();
-                select(*item);
-            }
-            break;
-        }
+        toggleselect(*item);
     }
-    return catched;
+    else if(!item->selected())
+    {
+        clearSelection();
+        select(*item);
+    }
+    return true;
 }
 
 void PGE_EditScene::closeEvent(QCloseEvent *event)
 {
     m_abortThread = true;
 
-    bool wasBusy = m_isBusy.owns_lock();
+    bool wasBusy = m_isBusy;
     if(wasBusy)
     {
         if(m_busyIsClosing)
@@ -398,14 +598,14 @@ void PGE_EditScene::closeEvent(QCloseEvent *event)
             event->ignore();
             return;
         }
-        m_busyMutex.lock();
-        m_busyMutex.unlock();
+        // Aborted above, the loading stops at its next element
+        m_busyThread.waitForFinished();
     }
 
     if(wasBusy && !m_busyIsClosing)
         QMessageBox::information(this, "Closed", "Ouuuuch.... :-P");
 
-    if(!m_tree.empty())
+    if(!m_tree->empty())
     {
         startDeInitAsync();
         qDebug() << "Close delayed - run clean-up";
@@ -418,8 +618,9 @@ void PGE_EditScene::closeEvent(QCloseEvent *event)
 
 void PGE_EditScene::mousePressEvent(QMouseEvent *event)
 {
-    if(m_isBusy.owns_lock())
+    if(isBusy())
         return;
+    postponeIndexOptimize();
 
     bool isShift = (event->modifiers() & Qt::ShiftModifier) != 0;
     bool isCtrl = (event->modifiers() & Qt::ControlModifier) != 0;
@@ -524,8 +725,9 @@ void PGE_EditScene::mousePressEvent(QMouseEvent *event)
 
 void PGE_EditScene::mouseMoveEvent(QMouseEvent *event)
 {
-    if(m_isBusy.owns_lock())
+    if(isBusy())
         return;
+    postponeIndexOptimize();
 
     if((event->buttons() & Qt::LeftButton) == 0)
         return;
@@ -549,13 +751,17 @@ void PGE_EditScene::mouseMoveEvent(QMouseEvent *event)
     m_mouseOld = pos;
     m_mouseMoved = true;
 
+    // counted by the index without collecting the items, so it's cheap on a huge rectangle too
+    if(m_rectSelect)
+        setWindowTitle(QString("Items in area: %1").arg(m_tree->countIn(rectSelectionZone(m_mouseOld))));
+
     if(doRepaint)
         repaint();
 }
 
 void PGE_EditScene::mouseReleaseEvent(QMouseEvent *event)
 {
-    if(m_isBusy.owns_lock())
+    if(isBusy())
         return;
     bool doRepaint = false;
     bool isShift = (event->modifiers() & Qt::ShiftModifier) != 0;
@@ -606,16 +812,12 @@ void PGE_EditScene::mouseReleaseEvent(QMouseEvent *event)
     }
     else if(m_rectSelect)
     {
-        qreal left   = m_mouseBegin.x() < m_mouseEnd.x() ? m_mouseBegin.x() : m_mouseEnd.x();
-        qreal right  = m_mouseBegin.x() > m_mouseEnd.x() ? m_mouseBegin.x() : m_mouseEnd.x();
-        qreal top    = m_mouseBegin.y() < m_mouseEnd.y() ? m_mouseBegin.y() : m_mouseEnd.y();
-        qreal bottom = m_mouseBegin.y() > m_mouseEnd.y() ? m_mouseBegin.y() : m_mouseEnd.y();
-
         PGE_EditItemList list;
-        PGE_Rect<int64_t> selZone;
-        //RRect vizArea = {left, top, right, bottom};
-        selZone.setCoords(D_TO_INT64(left), D_TO_INT64(top), D_TO_INT64(right), D_TO_INT64(bottom));
-        queryItems(selZone, &list);
+        PGE_Rect<int64_t> selZone = rectSelectionZone(m_mouseEnd);
+        if(selZone.width() * selZone.height() > c_parallelSelectionArea)
+            m_tree->queryParallel(selZone, &list);
+        else
+            queryItems(selZone, &list);
         if(!list.isEmpty())
         {
             PGE_EditSceneItem *it = list.first();
@@ -655,8 +857,9 @@ void PGE_EditScene::mouseReleaseEvent(QMouseEvent *event)
 
 void PGE_EditScene::wheelEvent(QWheelEvent *event)
 {
-    if(m_isBusy.owns_lock())
+    if(isBusy())
         return;
+    postponeIndexOptimize();
 
     bool isShift = (event->modifiers() & Qt::ShiftModifier) != 0;
     bool isCtrl  = (event->modifiers() & Qt::ControlModifier) != 0;
@@ -712,7 +915,7 @@ void PGE_EditScene::drawSubtreeRecursive(QGraphicsItem *item, QPainter *painter,
 void PGE_EditScene::paintEvent(QPaintEvent */*event*/)
 {
     QPainter p(this);
-    if(m_isBusy.owns_lock())
+    if(isBusy())
     {
         p.setBrush(QBrush(Qt::black));
         p.setPen(QPen(Qt::black));
@@ -729,12 +932,57 @@ void PGE_EditScene::paintEvent(QPaintEvent */*event*/)
         return;
     }
 
-    PGE_EditItemList list;
     PGE_Rect<int64_t> vizArea(D_TO_INT64(m_cameraPos.x()),
                               D_TO_INT64(m_cameraPos.y()),
                               D_TO_INT64(qreal(width()) / m_zoom),
                               D_TO_INT64(qreal(height()) / m_zoom));
-    queryItems(vizArea, &list);
+    // Floating layer: selected items are drawn at their positions plus moving offset
+    PGE_Rect<int64_t> floatArea = vizArea;
+    floatArea.moveBy(-m_moveOffsetX, -m_moveOffsetY);
+
+    // Zoomed out, the small nodes are drawn as cells shaded by their cached counts instead of walking down to
+    // their elements, so the painting doesn't grow with the count of items (the moving layer needs them all)
+    const PgeQuadTree *lodTree = nullptr;
+    if(m_lodEnabled && m_lodCellSize > 0.0 && !m_moveInProcess)
+        lodTree = dynamic_cast<const PgeQuadTree *>(m_tree.get());
+    PGE_EditItemList list, floatList;
+    struct LodCell
+    {
+        QRectF rect;
+        QColor color;
+    };
+    QVector<LodCell> lodCells;
+    if(lodTree)
+    {
+        const double zoomSquared = m_zoom * m_zoom;
+        lodTree->queryCoarse(vizArea, D_TO_INT64(m_lodCellSize / m_zoom), [&list](PGE_EditSceneItem *item)
+        {
+            list.push_back(item);
+            return true;
+        },
+        [&lodCells, zoomSquared](const PGE_Rect<int64_t> &itemsRect, int itemsCount)
+        {
+            double pixels = std::max(1.0, double(itemsRect.width()) * double(itemsRect.height()) * zoomSquared);
+            double shade = std::min(1.0, double(itemsCount) / pixels / c_lodFullDensity);
+            QRectF cell(itemsRect.x(), itemsRect.y(), itemsRect.width(), itemsRect.height());
+            lodCells.push_back({cell, QColor(0, 0, 0, int(shade * 255.0))});
+            return true;
+        });
+    }
+    else
+    {
+        // Both areas are mostly the same, so they are collected in one walk of the tree
+        const PGE_Rect<int64_t> zones[2] = {vizArea, floatArea};
+        m_tree->queryMany(zones, m_moveInProcess ? 2 : 1, [&list, &floatList](PGE_EditSceneItem *item, int zone)
+        {
+            if(zone == 0)
+                list.push_back(item);
+            else if(item->m_selected)
+                floatList.push_back(item);
+            return true;
+        });
+    }
+    sortByZOrder(list);
 
     p.save();
     p.scale(m_zoom, m_zoom);
@@ -744,6 +992,8 @@ void PGE_EditScene::paintEvent(QPaintEvent */*event*/)
     {
         if(!item->isVisible())
             continue; // Don't draw invisible items
+        if(m_moveInProcess && item->m_selected)
+            continue; // Moving items are drawn as floating layer
         p.save();
         p.translate(item->boundingRect().topLeft()); // Offset by item's location
         p.setOpacity(item->opacity());
@@ -761,6 +1011,26 @@ void PGE_EditScene::paintEvent(QPaintEvent */*event*/)
         p.restore();
     }
 
+    // Over the large elements, the small ones are usually on top of them
+    for(const LodCell &cell : lodCells)
+        p.fillRect(cell.rect, cell.color);
+
+    if(m_moveInProcess)
+    {
+        sortByZOrder(floatList);
+        p.translate(QPointF(m_moveOffsetX, m_moveOffsetY));
+        for(PGE_EditSceneItem *item : floatList)
+        {
+            if(!item->isVisible())
+                continue;
+            drawSubtreeRecursive(item, &p, this, 1.0);
+        }
+        p.translate(QPointF(-m_moveOffsetX, -m_moveOffsetY));
+    }
+
+    if(m_showIndexNodes)
+        drawIndexNodes(&p, vizArea);
+
     p.restore();
 
     if(m_rectSelect)
@@ -781,13 +1051,22 @@ void PGE_EditScene::paintEvent(QPaintEvent */*event*/)
         p.drawRect(r);
     }
 
+    if(m_isLoading)
+    {
+        p.setOpacity(1.0);
+        p.setBrush(QBrush(Qt::black));
+        p.setPen(QPen(Qt::black));
+        p.drawText(QPointF(20.0, 20.0), m_busyMessage);
+    }
+
     p.end();
 }
 
 void PGE_EditScene::keyPressEvent(QKeyEvent *event)
 {
-    if(m_isBusy.owns_lock())
+    if(isBusy())
         return;
+    postponeIndexOptimize();
 
     bool isCtrl = (event->modifiers() & Qt::ControlModifier) != 0;
     switch(event->key())
@@ -848,6 +1127,14 @@ void PGE_EditScene::keyPressEvent(QKeyEvent *event)
         deleteSelectedItems();
         repaint();
         break;
+    case Qt::Key_PageUp:
+        moveSelectionLayer(1);
+        repaint();
+        break;
+    case Qt::Key_PageDown:
+        moveSelectionLayer(-1);
+        repaint();
+        break;
     default:
         QWidget::keyPressEvent(event);
         return;
@@ -856,12 +1143,14 @@ void PGE_EditScene::keyPressEvent(QKeyEvent *event)
 
 void PGE_EditScene::keyReleaseEvent(QKeyEvent *event)
 {
-    if(m_isBusy.owns_lock())
+    if(isBusy())
         return;
 
     switch(event->key())
     {
     case Qt::Key_Escape:
+        if(m_moveInProcess)
+            moveEnd(true);
         clearSelection();
         m_rectSelect = false;
         repaint();
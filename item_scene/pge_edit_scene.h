@@ -7,10 +7,11 @@
 #include <QSet>
 #include <QTimer>
 #include <QAtomicInteger>
-#include <mutex>
+#include <QFuture>
+#include <memory>
 
 #include "pge_edit_scene_item.h"
-#include "pge_quad_tree.h"
+#include "pge_scene_index.h"
 
 #define D_TO_INT64(x) static_cast<int64_t>(std::round(x))
 
@@ -18,7 +19,23 @@ class PGE_EditScene : public QWidget
 {
     Q_OBJECT
 public:
-    explicit PGE_EditScene(QWidget *parent = nullptr);
+    //! Kinds of the spatial index of elements
+    enum IndexBackend
+    {
+        //! Loose quadtree, works with elements of any sizes
+        IndexLooseQuadTree = 0,
+        //! Sparse grid of chunks, made for tile-aligned elements
+        IndexTileGrid,
+        //! Packed R-tree with an overlay for edits, made for levels which are mostly viewed
+        IndexPackedRTree
+    };
+
+    /**
+     * @brief Constructor
+     * @param parent Parent widget
+     * @param index Kind of the spatial index of elements
+     */
+    explicit PGE_EditScene(QWidget *parent = nullptr, IndexBackend index = IndexLooseQuadTree);
     virtual ~PGE_EditScene();
 
     /**
@@ -27,13 +44,19 @@ public:
      * @param y Position Y
      */
     PGE_EditSceneItem *addRect(int64_t x, int64_t y);
+    /**
+     * @brief Creates a new rectangular body without of registering it in the tree
+     * @param x Position X
+     * @param y Position Y
+     */
+    PGE_EditSceneItem *createRect(int64_t x, int64_t y);
 
     /**
      * @brief Clear selection list
      */
     void clearSelection();
     /**
-     * @brief Move all selected bodies by relative offset
+     * @brief Move all selected bodies by relative offset (while moving by mouse, offset is accumulated until moving end)
      * @param deltaX Offset X
      * @param deltaY Offset Y
      */
@@ -43,6 +66,11 @@ public:
      * @brief Calculate size of abstract rectangular zone
      */
     void captureSelectionRect();
+    /**
+     * @brief Area of the rectangular selection between the mouse press point and another one
+     * @param end The other corner of the area
+     */
+    PGE_Rect<int64_t> rectSelectionZone(const QPointF &end) const;
 
     /**
      * @brief Add element into selection list
@@ -66,6 +94,18 @@ public:
      */
     void setItemSelected(PGE_EditSceneItem &item, bool selected);
 
+    /**
+     * @brief Move element into another drawing layer, it will be drawn over other elements of that layer
+     * @param item reference to scene element
+     * @param layer drawing layer (higher layers are drawn over lower ones)
+     */
+    void setItemLayer(PGE_EditSceneItem &item, int layer);
+    /**
+     * @brief Move selected elements into a higher or lower drawing layer
+     * @param delta Count of layers to go up (or down if negative)
+     */
+    void moveSelectionLayer(int delta);
+
     /**
      * @brief Begin elements moving by mouse
      */
@@ -77,7 +117,7 @@ public:
     void moveEnd(bool esc = false);
 
     /**
-     * @brief Begin asynchronius initializing process (scene window will be inactive, but application can be used)
+     * @brief Begin asynchronius initializing process (scene window shows elements as soon as they are loaded and can be used)
      */
     virtual void startInitAsync();
     /**
@@ -94,8 +134,58 @@ public:
     virtual void deInitThread();
 
     typedef QVector<PGE_EditSceneItem *> PGE_EditItemList;
-    typedef PgeQuadTree IndexTree4;
-    IndexTree4 m_tree;
+    typedef PgeSceneIndex IndexTree4;
+    std::unique_ptr<IndexTree4> m_tree;
+    //! Counts down the user's idle time before the index gets optimized
+    QTimer m_indexIdleTimer;
+    /**
+     * @brief Start the idle countdown if the index has changes to optimize (call it after edits)
+     */
+    void scheduleIndexOptimize();
+    /**
+     * @brief Restart the idle countdown if it's running (call it on the user's input)
+     */
+    void postponeIndexOptimize();
+    /**
+     * @brief Optimize the index, or wait more if the user is still doing something
+     */
+    void optimizeIndex();
+    //! Runs the index compaction in short slices whenever the event loop is idle
+    QTimer m_indexCompactTimer;
+    /**
+     * @brief Start the compaction if removed elements still take place in the index (call it after edits)
+     */
+    Q_INVOKABLE void scheduleIndexCompact();
+    /**
+     * @brief Compact the index for one slice of time, stop when it's done
+     */
+    void compactIndexStep();
+    //! Draw the nodes of the index over the elements, coloured by their occupancy
+    bool m_showIndexNodes = false;
+    /**
+     * @brief Show or hide the nodes of the index (only the loose quadtree has them)
+     */
+    void toggleIndexNodes();
+    /**
+     * @brief Draw the nodes of the index which are in the area, the painter is in world coordinates
+     * @param painter Painter of the scene
+     * @param zone Visible area of the scene
+     */
+    void drawIndexNodes(QPainter *painter, const PGE_Rect<int64_t> &zone);
+    //! Draw the elements of small index nodes as one density-shaded cell per node
+    bool m_lodEnabled = true;
+    //! Index nodes smaller than this on the screen (in pixels) are drawn as cells when the level of detail is on
+    double m_lodCellSize = 8.0;
+    /**
+     * @brief Set the level of detail: elements of the index nodes smaller than the size on the screen are drawn
+     * as one density-shaded cell per node (only the loose quadtree has nodes, other indexes draw every element)
+     * @param pixels Size of the nodes on the screen, 0 draws every element
+     */
+    void setLodCellSize(double pixels);
+    /**
+     * @brief Turn the level of detail on or off
+     */
+    void toggleLod();
     struct RRect
     {
         int l;
@@ -121,6 +211,11 @@ public:
      * @param item Pointer to element to register
      */
     void registerElement(PGE_EditSceneItem *item);
+    /**
+     * @brief Register multiple elements in the tree at once
+     * @param items List of elements to register
+     */
+    void registerElements(const PGE_EditItemList &items);
     /**
      * @brief Update registered element in the tree
      * @param item Pointer to element to register
@@ -152,6 +247,10 @@ public:
     bool            m_ignoreRelease;
     //! Is elements moving in process
     bool            m_moveInProcess;
+    //! Offset of selected elements while moving, they are drawn as floating layer and updated in the tree at moving end
+    int64_t         m_moveOffsetX;
+    //! Offset of selected elements while moving, they are drawn as floating layer and updated in the tree at moving end
+    int64_t         m_moveOffsetY;
     //! Is rectangular selection in process
     bool            m_rectSelect;
 
@@ -160,12 +259,19 @@ public:
     //! Zoom factor
     double          m_zoom;
 
-    std::mutex      m_busyMutex;
+    //! Loading or closing thread, the scene waits for it when it's closed meanwhile
+    QFuture<void>   m_busyThread;
     QString         m_busyMessage;
-    bool            m_busyIsClosing = false;
-    std::unique_lock<std::mutex> m_isBusy;
+    QAtomicInteger<bool> m_busyIsClosing;
+    //! Loading or closing thread owns the scene, it's set and cleared on different threads
+    QAtomicInteger<bool> m_isBusy;
+    //! Initializing thread is still inserting elements, the scene can be used meanwhile
+    QAtomicInteger<bool> m_isLoading;
     QAtomicInteger<bool> m_abortThread;
 
+    //! Is the scene not available for the user (busy, but not just loading)
+    bool isBusy() const;
+
     //! Map relative mouse cursor position to world coordinates
     QPointF      mapToWorld(const QPointF &mousePos);
     //! Map world rectangle coordinates to screen with applying zoom factor
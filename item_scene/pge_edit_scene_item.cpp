@@ -14,6 +14,7 @@ PGE_EditSceneItem::PGE_EditSceneItem(const PGE_EditSceneItem &it) :
     QGraphicsItem(it.parentItem()),
     m_scene(it.m_scene),
     m_selected(it.m_selected),
+    m_zLayer(it.m_zLayer),
     m_posRect(it.m_posRect)
 {}
 
@@ -33,6 +34,11 @@ bool PGE_EditSceneItem::selected() const
     return m_selected;
 }
 
+int PGE_EditSceneItem::zLayer() const
+{
+    return m_zLayer;
+}
+
 bool PGE_EditSceneItem::isTouching(int64_t x, int64_t y) const
 {
     if(m_posRect.left() > x)
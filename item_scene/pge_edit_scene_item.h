@@ -6,6 +6,8 @@
 #include <QGraphicsItem>
 #include "pge_rect.h"
 #include "pge_quad_tree.h"
+#include "pge_tile_grid.h"
+#include "LooseQuadtree.h"
 
 #include <QTransform>
 
@@ -14,9 +16,25 @@ class PGE_EditScene;
 class PGE_EditSceneItem : public QGraphicsItem
 {
     friend class PGE_EditScene;
+    friend class PgeSceneIndex;
+    friend class PgeTileGrid;
+    friend class PgePackedRTree;
+    friend class QTreePGE_Phys_ObjectExtractor;
     PGE_EditScene *m_scene = nullptr;
     PGE_EditSceneItem *m_parent = nullptr;
     bool m_selected = false;
+    //! Index in the list of all elements of the tree, -1 if not registered
+    int  m_treeSlot = -1;
+    //! Place of element inside of the tree (used by the tree only, replaces a hash lookup)
+    loose_quadtree::ObjectHandle<PGE_EditSceneItem> m_treeHandle;
+    //! Place of element inside of the tile grid (used by the grid only)
+    PgeTileGridHandle m_gridHandle;
+    //! Index of element inside of the packed R-tree, -1 if it's in the overlay or not registered (used by the packed tree only)
+    int  m_packedSlot = -1;
+    //! Drawing layer, higher layers are drawn over lower ones
+    int  m_zLayer = 0;
+    //! Insertion sequence number inside of the tree, later inserted are drawn over earlier ones
+    uint32_t m_zSeq = 0;
     QTransform m_transform;
 
 public:
@@ -27,6 +45,16 @@ public:
     void setSelected(bool selected);
     bool selected() const;
 
+    int zLayer() const;
+    /**
+     * @brief Drawing order of the element (layer, then insertion sequence)
+     * @return Elements with a higher value are drawn over the others
+     */
+    uint64_t zOrder() const
+    {
+        return uint64_t(uint32_t(m_zLayer) ^ 0x80000000u) << 32 | m_zSeq;
+    }
+
     bool isTouching(int64_t x, int64_t y) const;
     bool isTouching(const QRect &rect) const;
     bool isTouching(const QRectF &rect) const;
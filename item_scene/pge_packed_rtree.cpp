@@ -0,0 +1,505 @@
+#include "pge_packed_rtree.h"
+#include "pge_edit_scene_item.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+//! Maximal count of children of a node
+static const int c_nodeCapacity = 16;
+//! Levels of the tree are enough for any int count of elements (16^8 > 2^31)
+static const int c_maxLevels = 8;
+
+/**
+ * @brief Position on the Hilbert curve which fills the 65536x65536 square
+ * @param x Position X (16 bits)
+ * @param y Position Y (16 bits)
+ * @return Distance along the curve, neighbouring positions have close distances
+ */
+static quint32 hilbertIndex(quint32 x, quint32 y)
+{
+    const quint32 n = 1u << 16;
+    quint32 d = 0;
+    for(quint32 s = n / 2; s > 0; s /= 2)
+    {
+        quint32 rx = (x & s) ? 1 : 0;
+        quint32 ry = (y & s) ? 1 : 0;
+        d += s * s * ((3 * rx) ^ ry);
+        // Rotate the quadrant, so the curve is continuous
+        if(ry == 0)
+        {
+            if(rx == 1)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+PgePackedRTree::PgePackedRTree()
+{}
+
+PgePackedRTree::~PgePackedRTree()
+{}
+
+void PgePackedRTree::pack(const PgePackedRTree::ItemsList &items)
+{
+    for(const Entry &e : m_entries)
+    {
+        if(e.item)
+            e.item->m_packedSlot = -1;
+    }
+    m_entries.clear();
+    m_nodes.clear();
+    m_leafNodes = 0;
+    m_holes = 0;
+    if(items.isEmpty())
+        return;
+
+    // Centers are mapped into the curve's square by the bounds of all of them
+    std::vector<std::pair<quint32, Entry> > sorted;
+    sorted.reserve(items.size());
+    int64_t minX = 0, minY = 0, maxX = 0, maxY = 0;
+    for(int i = 0; i < items.size(); i++)
+    {
+        PGE_Rect<int64_t> r = items[i]->boundingRectI();
+        Entry e = {r.x(), r.y(), r.width(), r.height(), items[i]};
+        int64_t cx = e.left + e.width / 2;
+        int64_t cy = e.top + e.height / 2;
+        if(i == 0)
+        {
+            minX = maxX = cx;
+            minY = maxY = cy;
+        }
+        minX = std::min(minX, cx);
+        maxX = std::max(maxX, cx);
+        minY = std::min(minY, cy);
+        maxY = std::max(maxY, cy);
+        sorted.push_back(std::make_pair(0u, e));
+    }
+    const double scaleX = 65535.0 / double(std::max<int64_t>(maxX - minX, 1));
+    const double scaleY = 65535.0 / double(std::max<int64_t>(maxY - minY, 1));
+    for(std::pair<quint32, Entry> &s : sorted)
+    {
+        const Entry &e = s.second;
+        quint32 hx = quint32(double(e.left + e.width / 2 - minX) * scaleX);
+        quint32 hy = quint32(double(e.top + e.height / 2 - minY) * scaleY);
+        s.first = hilbertIndex(hx, hy);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<quint32, Entry> &a, const std::pair<quint32, Entry> &b)
+    {
+        return a.first < b.first;
+    });
+
+    m_entries.reserve(sorted.size());
+    for(const std::pair<quint32, Entry> &s : sorted)
+    {
+        s.second.item->m_packedSlot = int(m_entries.size());
+        m_entries.push_back(s.second);
+    }
+
+    // Leaves over runs of entries
+    const int count = int(m_entries.size());
+    m_nodes.reserve(count / (c_nodeCapacity - 1) + 2);
+    for(int first = 0; first < count; first += c_nodeCapacity)
+    {
+        Node node = {0, 0, 0, 0, first, std::min(c_nodeCapacity, count - first)};
+        for(int i = first; i < first + node.count; i++)
+        {
+            const Entry &e = m_entries[i];
+            if(i == first)
+            {
+                node.left = e.left;
+                node.top = e.top;
+                node.right = e.left + e.width;
+                node.bottom = e.top + e.height;
+                continue;
+            }
+            node.left = std::min(node.left, e.left);
+            node.top = std::min(node.top, e.top);
+            node.right = std::max(node.right, e.left + e.width);
+            node.bottom = std::max(node.bottom, e.top + e.height);
+        }
+        m_nodes.push_back(node);
+    }
+    m_leafNodes = int(m_nodes.size());
+
+    // Upper levels over runs of the previous level's nodes, until one root is left
+    int levelBegin = 0;
+    int levelEnd = m_leafNodes;
+    while(levelEnd - levelBegin > 1)
+    {
+        for(int first = levelBegin; first < levelEnd; first += c_nodeCapacity)
+        {
+            Node node = m_nodes[first];
+            node.first = first;
+            node.count = std::min(c_nodeCapacity, levelEnd - first);
+            for(int i = first + 1; i < first + node.count; i++)
+            {
+                const Node &child = m_nodes[i];
+                node.left = std::min(node.left, child.left);
+                node.top = std::min(node.top, child.top);
+                node.right = std::max(node.right, child.right);
+                node.bottom = std::max(node.bottom, child.bottom);
+            }
+            m_nodes.push_back(node);
+        }
+        levelBegin = levelEnd;
+        levelEnd = int(m_nodes.size());
+    }
+}
+
+void PgePackedRTree::dropEntry(PGE_EditSceneItem *obj)
+{
+    m_entries[obj->m_packedSlot].item = nullptr;
+    obj->m_packedSlot = -1;
+    m_holes++;
+}
+
+bool PgePackedRTree::updateOne(PGE_EditSceneItem *obj)
+{
+    if(addItem(obj))
+    {
+        m_overlay.Insert(obj);
+        return true;
+    }
+
+    if(obj->m_packedSlot < 0)
+        return m_overlay.Update(obj);
+
+    // While the element stays inside of its leaf's bounds, the packed tree is still valid
+    PGE_Rect<int64_t> r = obj->boundingRectI();
+    const Node &leaf = m_nodes[obj->m_packedSlot / c_nodeCapacity];
+    if(leaf.left <= r.x() && r.x() + r.width() <= leaf.right &&
+       leaf.top <= r.y() && r.y() + r.height() <= leaf.bottom)
+    {
+        Entry &e = m_entries[obj->m_packedSlot];
+        e.left = r.x();
+        e.top = r.y();
+        e.width = r.width();
+        e.height = r.height();
+        m_counters.inPlace++;
+        return true;
+    }
+
+    dropEntry(obj);
+    m_overlay.Insert(obj);
+    m_counters.relinked++;
+    return true;
+}
+
+bool PgePackedRTree::insert(PGE_EditSceneItem *obj)
+{
+    QWriteLocker locker(&m_lock);
+    if(!addItem(obj))
+    {
+        updateOne(obj);
+        return false;
+    }
+    return m_overlay.Insert(obj);
+}
+
+void PgePackedRTree::insertBulk(const PgePackedRTree::ItemsList &objs)
+{
+    QWriteLocker locker(&m_lock);
+    const bool packNow = m_entries.empty() && m_overlay.IsEmpty();
+    reserveItems(objs.size());
+    ItemsList added;
+    added.reserve(objs.size());
+    for(PGE_EditSceneItem *obj : objs)
+    {
+        if(addItem(obj))
+            added.push_back(obj);
+        else
+            updateOne(obj);
+    }
+    if(packNow)
+        pack(added);
+    else
+        m_overlay.InsertBulk(added.begin(), added.end());
+}
+
+bool PgePackedRTree::update(PGE_EditSceneItem *obj)
+{
+    QWriteLocker locker(&m_lock);
+    return updateOne(obj);
+}
+
+void PgePackedRTree::updateMany(const PgePackedRTree::ItemsSet &objs, int64_t dx, int64_t dy)
+{
+    QWriteLocker locker(&m_lock);
+    for(PGE_EditSceneItem *obj : objs)
+    {
+        obj->m_posRect.moveBy(dx, dy);
+        updateOne(obj);
+    }
+}
+
+PgePackedRTree::UpdateCounters PgePackedRTree::updateCounters() const
+{
+    QReadLocker locker(&m_lock);
+    UpdateCounters c = m_counters;
+    c.inPlace += m_overlay.GetInPlaceUpdateCount();
+    c.relinked += m_overlay.GetRelinkingUpdateCount();
+    return c;
+}
+
+void PgePackedRTree::resetUpdateCounters()
+{
+    QWriteLocker locker(&m_lock);
+    m_counters = UpdateCounters();
+    m_overlay.ResetUpdateCounters();
+}
+
+bool PgePackedRTree::remove(PGE_EditSceneItem *obj)
+{
+    if(!obj)
+        return false;
+    QWriteLocker locker(&m_lock);
+    if(obj->m_packedSlot >= 0)
+        dropEntry(obj);
+    else if(!m_overlay.Remove(obj))
+        return false;
+    removeItem(obj);
+    return true;
+}
+
+bool PgePackedRTree::needsOptimize() const
+{
+    QReadLocker locker(&m_lock);
+    return m_holes > 0 || !m_overlay.IsEmpty();
+}
+
+void PgePackedRTree::optimize()
+{
+    QWriteLocker locker(&m_lock);
+    if(m_holes == 0 && m_overlay.IsEmpty())
+        return;
+    m_overlay.Clear();
+    pack(items());
+}
+
+void PgePackedRTree::clearIndex(const PgePackedRTree::ItemsList &items)
+{
+    for(PGE_EditSceneItem *obj : items)
+        obj->m_packedSlot = -1;
+    m_entries.clear();
+    m_nodes.clear();
+    m_leafNodes = 0;
+    m_holes = 0;
+    m_overlay.Clear();
+}
+
+template<class NodeFilter, class Visitor>
+bool PgePackedRTree::walk(NodeFilter &&nodeFilter, Visitor &&visitor) const
+{
+    if(m_nodes.empty())
+        return true;
+    // Depth-first, every popped node pushes at most all of its children
+    int stack[c_maxLevels * c_nodeCapacity];
+    int depth = 0;
+    stack[depth++] = int(m_nodes.size()) - 1;
+    while(depth > 0)
+    {
+        const int index = stack[--depth];
+        const Node &node = m_nodes[index];
+        if(!nodeFilter(node))
+            continue;
+        if(index < m_leafNodes)
+        {
+            for(int i = node.first; i < node.first + node.count; i++)
+            {
+                const Entry &e = m_entries[i];
+                if(e.item && !visitor(e))
+                    return false;
+            }
+            continue;
+        }
+        // Reversed, so children are visited in their order
+        for(int i = node.first + node.count - 1; i >= node.first; i--)
+            stack[depth++] = i;
+    }
+    return true;
+}
+
+template<class Visitor>
+bool PgePackedRTree::forEachIntersecting(const PGE_Rect<int64_t> &zone, Visitor &&visitor) const
+{
+    const int64_t left = zone.x();
+    const int64_t top = zone.y();
+    const int64_t right = zone.x() + zone.width();
+    const int64_t bottom = zone.y() + zone.height();
+    bool goOn = walk([&](const Node &n)
+    {
+        return !(n.right <= left || right <= n.left || n.bottom <= top || bottom <= n.top);
+    },
+    [&](const Entry &e)
+    {
+        if(e.left + e.width <= left || right <= e.left ||
+           e.top + e.height <= top || bottom <= e.top)
+            return true;
+        return visitor(e.item);
+    });
+    if(!goOn)
+        return false;
+    return m_overlay.ForEachIntersecting(loose_quadtree::BoundingBox<int64_t>(left, top, zone.width(), zone.height()),
+                                         std::forward<Visitor>(visitor));
+}
+
+bool PgePackedRTree::query(const PGE_Rect<int64_t> &zone, PgePackedRTree::t_resultCallback a_resultCallback, void *context) const
+{
+    QReadLocker locker(&m_lock);
+    return forEachIntersecting(zone, [a_resultCallback, context](PGE_EditSceneItem *item)
+    {
+        return a_resultCallback(item, context);
+    });
+}
+
+void PgePackedRTree::query(const PGE_Rect<int64_t> &zone, PgePackedRTree::ItemsList *resultList) const
+{
+    QReadLocker locker(&m_lock);
+    forEachIntersecting(zone, [resultList](PGE_EditSceneItem *item)
+    {
+        resultList->push_back(item);
+        return true;
+    });
+}
+
+bool PgePackedRTree::queryMany(const PGE_Rect<int64_t> *zones, int n, PgePackedRTree::t_zoneResultCallback a_resultCallback, void *context) const
+{
+    QReadLocker locker(&m_lock);
+    for(int i = 0; i < n; i++)
+    {
+        bool goOn = forEachIntersecting(zones[i], [a_resultCallback, context, i](PGE_EditSceneItem *item)
+        {
+            return a_resultCallback(item, i, context);
+        });
+        if(!goOn)
+            return false;
+    }
+    return true;
+}
+
+PGE_EditSceneItem *PgePackedRTree::queryPoint(int64_t x, int64_t y) const
+{
+    QReadLocker locker(&m_lock);
+    PGE_EditSceneItem *topmost = m_overlay.FindTopmostContainingPoint(x, y);
+    walk([x, y](const Node &n)
+    {
+        return n.left <= x && x < n.right && n.top <= y && y < n.bottom;
+    },
+    [x, y, &topmost](const Entry &e)
+    {
+        if(e.left <= x && x < e.left + e.width && e.top <= y && y < e.top + e.height &&
+           (!topmost || e.item->zOrder() > topmost->zOrder()))
+            topmost = e.item;
+        return true;
+    });
+    return topmost;
+}
+
+void PgePackedRTree::nearest(int64_t x, int64_t y, int k, int64_t maxDistance, PgePackedRTree::ItemsList *resultList) const
+{
+    QReadLocker locker(&m_lock);
+    if(k <= 0)
+        return;
+    const double limit = double(maxDistance) * double(maxDistance);
+    typedef std::pair<double, PGE_EditSceneItem *> Candidate;
+
+    // The overlay gives its nearest in order already
+    std::vector<Candidate> fromOverlay;
+    m_overlay.ForEachNearest(x, y, maxDistance, [&](PGE_EditSceneItem *item)
+    {
+        PGE_Rect<int64_t> r = item->boundingRectI();
+        fromOverlay.push_back(Candidate(loose_quadtree::detail::SquaredDistance(loose_quadtree::BoundingBox<int64_t>(r.x(), r.y(), r.width(), r.height()), x, y), item));
+        return int(fromOverlay.size()) < k;
+    });
+
+    // Best-first walk of the packed tree, entries are coded as negative indices
+    std::vector<Candidate> fromPacked;
+    typedef std::pair<double, int> Pending;
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending> > pending;
+    if(!m_nodes.empty())
+        pending.push(Pending(0.0, int(m_nodes.size()) - 1));
+    while(!pending.empty() && int(fromPacked.size()) < k)
+    {
+        Pending p = pending.top();
+        pending.pop();
+        if(p.first > limit)
+            break;
+        if(p.second < 0)
+        {
+            fromPacked.push_back(Candidate(p.first, m_entries[-p.second - 1].item));
+            continue;
+        }
+        const Node &node = m_nodes[p.second];
+        for(int i = node.first; i < node.first + node.count; i++)
+        {
+            if(p.second < m_leafNodes)
+            {
+                const Entry &e = m_entries[i];
+                if(e.item)
+                    pending.push(Pending(loose_quadtree::detail::SquaredDistance(loose_quadtree::BoundingBox<int64_t>(e.left, e.top, e.width, e.height), x, y), -i - 1));
+            }
+            else
+            {
+                const Node &n = m_nodes[i];
+                pending.push(Pending(loose_quadtree::detail::SquaredDistance(loose_quadtree::BoundingBox<int64_t>(n.left, n.top, n.right - n.left, n.bottom - n.top), x, y), i));
+            }
+        }
+    }
+
+    // Both lists are sorted, the nearest k of them together
+    std::vector<Candidate>::const_iterator a = fromPacked.begin(), b = fromOverlay.begin();
+    for(int found = 0; found < k; found++)
+    {
+        if(a != fromPacked.end() && (b == fromOverlay.end() || a->first <= b->first))
+            resultList->push_back((a++)->second);
+        else if(b != fromOverlay.end())
+            resultList->push_back((b++)->second);
+        else
+            break;
+    }
+}
+
+bool PgePackedRTree::querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, PgePackedRTree::t_resultCallback a_resultCallback, void *context) const
+{
+    QReadLocker locker(&m_lock);
+    typedef std::pair<double, PGE_EditSceneItem *> Hit;
+    std::vector<Hit> hits;
+    walk([&](const Node &n)
+    {
+        double entry;
+        return loose_quadtree::detail::SegmentEntry(loose_quadtree::BoundingBox<int64_t>(n.left, n.top, n.right - n.left, n.bottom - n.top), x1, y1, x2, y2, &entry);
+    },
+    [&](const Entry &e)
+    {
+        double entry;
+        if(loose_quadtree::detail::SegmentEntry(loose_quadtree::BoundingBox<int64_t>(e.left, e.top, e.width, e.height), x1, y1, x2, y2, &entry))
+            hits.push_back(Hit(entry, e.item));
+        return true;
+    });
+    m_overlay.ForEachOnSegment(x1, y1, x2, y2, [&](PGE_EditSceneItem *item)
+    {
+        PGE_Rect<int64_t> r = item->boundingRectI();
+        double entry = 0.0;
+        loose_quadtree::detail::SegmentEntry(loose_quadtree::BoundingBox<int64_t>(r.x(), r.y(), r.width(), r.height()), x1, y1, x2, y2, &entry);
+        hits.push_back(Hit(entry, item));
+        return true;
+    });
+
+    std::sort(hits.begin(), hits.end(), [](const Hit &a, const Hit &b)
+    {
+        return a.first < b.first;
+    });
+    for(const Hit &hit : hits)
+    {
+        if(!a_resultCallback(hit.second, context))
+            return false;
+    }
+    return true;
+}
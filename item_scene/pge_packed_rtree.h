@@ -0,0 +1,110 @@
+#ifndef PGE_PACKED_RTREE_H
+#define PGE_PACKED_RTREE_H
+
+#include "pge_rect.h"
+#include "pge_scene_index.h"
+#include "pge_quad_tree.h"
+#include <vector>
+
+/**
+ * @brief Spatial index on a static R-tree packed by the Hilbert curve, made for levels which are mostly viewed
+ *
+ * Elements are sorted by the Hilbert order of their centers and packed into leaves of
+ * 16 entries, upper levels are built bottom-up, all nodes are kept in one contiguous
+ * array. Elements inserted or moved after packing live in a small loose quadtree
+ * overlay, removed ones are left as holes in the packed arrays. optimize() packs
+ * everything again, the scene calls it when the user is idle.
+ */
+class PgePackedRTree : public PgeSceneIndex
+{
+public:
+    PgePackedRTree();
+    PgePackedRTree(const PgePackedRTree &qt) = delete;
+    ~PgePackedRTree();
+
+    bool insert(PGE_EditSceneItem* obj) override;
+    /**
+     * @brief Insert a lot of elements at once, into an empty index they are packed right away,
+     * otherwise they go into the overlay until optimize()
+     * @param objs List of elements, already registered elements are updated
+     */
+    void insertBulk(const ItemsList &objs) override;
+    bool update(PGE_EditSceneItem* obj) override;
+    void updateMany(const ItemsSet &objs, int64_t dx, int64_t dy) override;
+    UpdateCounters updateCounters() const override;
+    void resetUpdateCounters() override;
+    bool remove(PGE_EditSceneItem* obj) override;
+
+    bool query(const PGE_Rect<int64_t> &zone, t_resultCallback a_resultCallback, void *context) const override;
+    void query(const PGE_Rect<int64_t> &zone, ItemsList *resultList) const override;
+    bool queryMany(const PGE_Rect<int64_t> *zones, int n, t_zoneResultCallback a_resultCallback, void *context) const override;
+    PGE_EditSceneItem *queryPoint(int64_t x, int64_t y) const override;
+    void nearest(int64_t x, int64_t y, int k, int64_t maxDistance, ItemsList *resultList) const override;
+    /**
+     * @brief Search elements crossed by a line segment, in the order the segment enters them
+     * (all of them are collected and sorted before the first callback, even when it stops the search)
+     */
+    bool querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, t_resultCallback a_resultCallback, void *context) const override;
+    using PgeSceneIndex::querySegment;
+
+    /**
+     * @brief Are there elements in the overlay or holes in the packed tree?
+     */
+    bool needsOptimize() const override;
+    /**
+     * @brief Pack all elements into a new static tree, the overlay becomes empty
+     */
+    void optimize() override;
+
+protected:
+    void clearIndex(const ItemsList &items) override;
+
+private:
+    //! Element with a copy of its bounding rectangle, item is nullptr for removed ones
+    struct Entry
+    {
+        int64_t left;
+        int64_t top;
+        int64_t width;
+        int64_t height;
+        PGE_EditSceneItem *item;
+    };
+    //! Bounding rectangle of the children: entries for the lowest level, nodes for others
+    struct Node
+    {
+        int64_t left;
+        int64_t top;
+        int64_t right;
+        int64_t bottom;
+        int first;
+        int count;
+    };
+
+    //! Packed elements in the Hilbert order, every leaf node covers a run of them
+    std::vector<Entry> m_entries;
+    //! Nodes level by level from the leaves, the root is the last one
+    std::vector<Node> m_nodes;
+    //! Count of the leaf nodes (at the beginning of m_nodes)
+    int m_leafNodes = 0;
+    //! Count of removed or moved out entries which are still in m_entries
+    int m_holes = 0;
+    //! Elements which were added or moved out of their leaf after packing
+    PgeQuadTree_private::IndexTreeQ m_overlay;
+    UpdateCounters m_counters;
+
+    void pack(const ItemsList &items);
+    bool updateOne(PGE_EditSceneItem *obj);
+    //! Make a hole in place of a packed element
+    void dropEntry(PGE_EditSceneItem *obj);
+    /**
+     * @brief Call visitor(const Entry &) on the packed entries under the nodes accepted by nodeFilter(const Node &)
+     * @return false if search was stopped by the visitor
+     */
+    template<class NodeFilter, class Visitor>
+    bool walk(NodeFilter &&nodeFilter, Visitor &&visitor) const;
+    //! Same as query(), on the packed entries and on the overlay
+    template<class Visitor>
+    bool forEachIntersecting(const PGE_Rect<int64_t> &zone, Visitor &&visitor) const;
+};
+
+#endif // PGE_PACKED_RTREE_H
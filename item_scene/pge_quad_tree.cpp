@@ -1,28 +1,8 @@
 #include "pge_quad_tree.h"
 #include "pge_edit_scene_item.h"
 
-#include "LooseQuadtree.h"
-
-class QTreePGE_Phys_ObjectExtractor
-{
-public:
-    static void ExtractBoundingBox(const PGE_EditSceneItem *object, loose_quadtree::BoundingBox<int64_t> *bbox)
-    {
-        auto r = object->boundingRectI();
-        bbox->left      = r.x();
-        bbox->top       = r.y();
-        bbox->width     = r.width();
-        bbox->height    = r.height();
-    }
-};
-
-struct PgeQuadTree_private
-{
-    typedef loose_quadtree::LooseQuadtree<int64_t, PGE_EditSceneItem, QTreePGE_Phys_ObjectExtractor> IndexTreeQ;
-    IndexTreeQ tree;
-    PgeQuadTree::ItemsSet items;
-};
-
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrentRun>
 
 PgeQuadTree::PgeQuadTree() :
     p(new PgeQuadTree_private)
@@ -33,71 +13,206 @@ PgeQuadTree::~PgeQuadTree()
 
 bool PgeQuadTree::insert(PGE_EditSceneItem *obj)
 {
-    p->items.insert(obj);
+    QWriteLocker locker(&m_lock);
+    addItem(obj);
     return p->tree.Insert(obj);
 }
 
+void PgeQuadTree::insertBulk(const PgeQuadTree::ItemsList &objs)
+{
+    QWriteLocker locker(&m_lock);
+    reserveItems(objs.size());
+    for(PGE_EditSceneItem *obj : objs)
+        addItem(obj);
+    p->tree.InsertBulk(objs.begin(), objs.end());
+}
+
 bool PgeQuadTree::update(PGE_EditSceneItem *obj)
 {
+    QWriteLocker locker(&m_lock);
+    addItem(obj);
     return p->tree.Update(obj);
 }
 
-bool PgeQuadTree::remove(PGE_EditSceneItem *obj)
+void PgeQuadTree::updateMany(const PgeQuadTree::ItemsSet &objs, int64_t dx, int64_t dy)
 {
-    p->items.remove(obj);
-    return p->tree.Remove(obj);
+    QWriteLocker locker(&m_lock);
+    for(PGE_EditSceneItem *obj : objs)
+    {
+        obj->m_posRect.moveBy(dx, dy);
+        addItem(obj);
+    }
+    p->tree.UpdateBulk(objs.begin(), objs.end());
 }
 
-bool PgeQuadTree::removeAndDestroy(PGE_EditSceneItem *obj)
+PgeQuadTree::UpdateCounters PgeQuadTree::updateCounters() const
+{
+    QReadLocker locker(&m_lock);
+    UpdateCounters c;
+    c.inPlace = p->tree.GetInPlaceUpdateCount();
+    c.relinked = p->tree.GetRelinkingUpdateCount();
+    return c;
+}
+
+void PgeQuadTree::resetUpdateCounters()
+{
+    QWriteLocker locker(&m_lock);
+    p->tree.ResetUpdateCounters();
+}
+
+bool PgeQuadTree::remove(PGE_EditSceneItem *obj)
 {
-    p->items.remove(obj);
-    bool ret = p->tree.Remove(obj);
     if(!obj)
         return false;
-    delete obj;
-    return ret;
+    QWriteLocker locker(&m_lock);
+    removeItem(obj);
+    return p->tree.Remove(obj);
 }
 
-void PgeQuadTree::clear()
+bool PgeQuadTree::query(const PGE_Rect<int64_t> &zone, PgeQuadTree::t_resultCallback a_resultCallback, void *context) const
 {
-    p->items.clear();
-    p->tree.Clear();
+    return query(zone, [a_resultCallback, context](PGE_EditSceneItem *item)
+    {
+        return a_resultCallback(item, context);
+    });
+}
+
+bool PgeQuadTree::queryMany(const PGE_Rect<int64_t> *zones, int n, PgeQuadTree::t_zoneResultCallback a_resultCallback, void *context) const
+{
+    return queryMany(zones, n, [a_resultCallback, context](PGE_EditSceneItem *item, int zone)
+    {
+        return a_resultCallback(item, zone, context);
+    });
 }
 
-void PgeQuadTree::clearAndDestroy()
+void PgeQuadTree::query(const PGE_Rect<int64_t> &zone, PgeQuadTree::ItemsList *resultList) const
 {
-    std::vector<PGE_EditSceneItem*> killList;
-    killList.reserve((size_t)p->items.size());
-    for(PGE_EditSceneItem *it : p->items)
-        killList.push_back(it);
-    p->items.clear();
-    for(PGE_EditSceneItem *it : killList)
-        delete it;
-    killList.clear();
-    clear();
+    query(zone, [resultList](PGE_EditSceneItem *item)
+    {
+        resultList->push_back(item);
+        return true;
+    });
 }
 
-void PgeQuadTree::query(PGE_Rect<int64_t> &zone, PgeQuadTree::t_resultCallback a_resultCallback, void *context) const
+void PgeQuadTree::queryParallel(const PGE_Rect<int64_t> &zone, PgeQuadTree::ItemsList *resultList) const
 {
-    PgeQuadTree_private::IndexTreeQ::Query q = p->tree.QueryIntersectsRegion(loose_quadtree::BoundingBox<int64_t>(zone.x(), zone.y(), zone.width(), zone.height()));
-    while(!q.EndOfQuery())
+    QReadLocker locker(&m_lock);
+    int parts = QThreadPool::globalInstance()->maxThreadCount();
+    if(parts <= 1)
     {
-        a_resultCallback(q.GetCurrent(), context);
-        q.Next();
+        query(zone, resultList);
+        return;
     }
+
+    loose_quadtree::BoundingBox<int64_t> region(zone.x(), zone.y(), zone.width(), zone.height());
+    QVector<ItemsList> found(parts);
+    auto collectPart = [this, &region, &found, parts](int part)
+    {
+        ItemsList &partList = found[part];
+        p->tree.ForEachIntersectingPart(region, part, parts, [&partList](PGE_EditSceneItem *item)
+        {
+            partList.push_back(item);
+            return true;
+        });
+    };
+
+    //The calling thread takes the first part, it waits for the rest anyway
+    QVector<QFuture<void> > tasks;
+    tasks.reserve(parts - 1);
+    for(int part = 1; part < parts; part++)
+        tasks.push_back(QtConcurrent::run([collectPart, part]()
+        {
+            collectPart(part);
+        }));
+    collectPart(0);
+    for(QFuture<void> &task : tasks)
+        task.waitForFinished();
+
+    int total = resultList->size();
+    for(const ItemsList &partList : found)
+        total += partList.size();
+    resultList->reserve(total);
+    for(const ItemsList &partList : found)
+        resultList->append(partList);
+}
+
+PGE_EditSceneItem *PgeQuadTree::queryPoint(int64_t x, int64_t y) const
+{
+    QReadLocker locker(&m_lock);
+    return p->tree.FindTopmostContainingPoint(x, y);
 }
 
-const PgeQuadTree::ItemsSet &PgeQuadTree::allItems() const
+void PgeQuadTree::nearest(int64_t x, int64_t y, int k, int64_t maxDistance, PgeQuadTree::ItemsList *resultList) const
 {
-    return p->items;
+    QReadLocker locker(&m_lock);
+    if(k <= 0)
+        return;
+    p->tree.ForEachNearest(x, y, maxDistance, [resultList, &k](PGE_EditSceneItem *item)
+    {
+        resultList->push_back(item);
+        return --k > 0;
+    });
 }
 
-size_t PgeQuadTree::count() const
+bool PgeQuadTree::querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, PgeQuadTree::t_resultCallback a_resultCallback, void *context) const
 {
-    return (size_t)p->items.count();
+    return querySegment(x1, y1, x2, y2, [a_resultCallback, context](PGE_EditSceneItem *item)
+    {
+        return a_resultCallback(item, context);
+    });
 }
 
-bool PgeQuadTree::empty() const
+int PgeQuadTree::countIn(const PGE_Rect<int64_t> &zone) const
 {
-    return p->items.isEmpty();
+    QReadLocker locker(&m_lock);
+    return p->tree.CountIntersecting(loose_quadtree::BoundingBox<int64_t>(zone.x(), zone.y(), zone.width(), zone.height()));
 }
+
+bool PgeQuadTree::boundsIn(const PGE_Rect<int64_t> &zone, PGE_Rect<int64_t> *bounds) const
+{
+    QReadLocker locker(&m_lock);
+    loose_quadtree::BoundingBox<int64_t> found(0, 0, 0, 0);
+    if(!p->tree.GetIntersectingBounds(loose_quadtree::BoundingBox<int64_t>(zone.x(), zone.y(), zone.width(), zone.height()), &found))
+        return false;
+    bounds->setRect(found.left, found.top, found.width, found.height);
+    return true;
+}
+
+PgeQuadTree::Stats PgeQuadTree::stats() const
+{
+    QReadLocker locker(&m_lock);
+    PgeQuadTree_private::IndexTreeQ::Statistics s = p->tree.GetStatistics();
+    Stats st;
+    for(int n : s.nodes_per_depth)
+        st.nodesPerDepth.push_back(n);
+    for(int n : s.objects_per_depth)
+        st.itemsPerDepth.push_back(n);
+    st.nodes = s.node_count;
+    st.items = s.object_count;
+    st.removedRecords = s.removed_records;
+    st.maxItemsPerNode = s.max_objects_per_node;
+    st.avgItemsPerNode = s.average_objects_per_node;
+    st.usedBlocks = s.used_blocks;
+    st.freeBlocks = s.free_blocks;
+    st.maximalDepth = s.maximal_depth;
+    st.looseBounds.setRect(s.loose_bounds.left, s.loose_bounds.top, s.loose_bounds.width, s.loose_bounds.height);
+    return st;
+}
+
+bool PgeQuadTree::needsCompact() const
+{
+    QReadLocker locker(&m_lock);
+    return p->tree.NeedsCleanup();
+}
+
+bool PgeQuadTree::compactStep(int budget)
+{
+    QWriteLocker locker(&m_lock);
+    return p->tree.CleanupStep(budget);
+}
+
+void PgeQuadTree::clearIndex(const PgeQuadTree::ItemsList &/*items*/)
+{
+    p->tree.Clear();
+}
+
@@ -2,17 +2,75 @@
 #define LVL_QUAD_TREE_H
 
 #include "pge_rect.h"
+#include "pge_scene_index.h"
+#include "LooseQuadtree.h"
 #include <memory>
-#include <QSet>
+#include <utility>
+#include <vector>
 
 struct PgeQuadTree_private;
 class PGE_EditSceneItem;
-class PgeQuadTree
+
+//! Tree access to elements (templates to not require a complete PGE_EditSceneItem here)
+class QTreePGE_Phys_ObjectExtractor
+{
+public:
+    template<class ItemT>
+    static void ExtractBoundingBox(const ItemT *object, loose_quadtree::BoundingBox<int64_t> *bbox)
+    {
+        auto r = object->boundingRectI();
+        bbox->left      = r.x();
+        bbox->top       = r.y();
+        bbox->width     = r.width();
+        bbox->height    = r.height();
+    }
+
+    template<class ItemT>
+    static loose_quadtree::ObjectHandle<ItemT> *ExtractObjectHandle(ItemT *object)
+    {
+        return &object->m_treeHandle;
+    }
+
+    template<class ItemT>
+    static unsigned long long ExtractZOrder(const ItemT *object)
+    {
+        return object->zOrder();
+    }
+};
+
+//! Spatial index on the loose quadtree
+class PgeQuadTree : public PgeSceneIndex
 {
     friend struct PgeQuadTree_private;
     std::unique_ptr<PgeQuadTree_private> p;
 public:
-    typedef QSet<PGE_EditSceneItem* > ItemsSet;
+    //! Shape of the tree, to see why a scene is slow
+    struct Stats
+    {
+        //! Count of nodes on every depth (the root is at 0)
+        QVector<int> nodesPerDepth;
+        //! Count of elements in the nodes of every depth
+        QVector<int> itemsPerDepth;
+        //! Count of all nodes
+        int nodes = 0;
+        //! Count of all elements
+        int items = 0;
+        //! Places of elements removed during queries, which wait for the compaction
+        int removedRecords = 0;
+        //! Elements of the fullest node
+        int maxItemsPerNode = 0;
+        //! Elements per node, empty nodes included
+        double avgItemsPerNode = 0.0;
+        //! Memory blocks of the tree with nodes or arrays in them
+        size_t usedBlocks = 0;
+        //! Memory blocks of the tree which the compaction would give back
+        size_t freeBlocks = 0;
+        //! Depth of the smallest elements, deeper nodes wait for the compaction
+        int maximalDepth = 0;
+        //! Area of the root node (elements may reach out of it by half of its size)
+        PGE_Rect<int64_t> looseBounds;
+    };
+
     PgeQuadTree();
     PgeQuadTree(const PgeQuadTree &qt) = delete;
     ~PgeQuadTree();
@@ -22,60 +80,175 @@ public:
      * @param obj Pointer to an element
      * @return true if success
      */
-    bool insert(PGE_EditSceneItem* obj);
+    bool insert(PGE_EditSceneItem* obj) override;
     /**
-     * @brief Update element's position inside of the tree
-     * @param obj Pointer to an element
-     * @return true if success
+     * @brief Insert a lot of elements at once, the tree is built in one pass (use it for level loading,
+     * queries of other threads wait for the whole list, so give it in chunks to let them see the progress)
+     * @param objs List of elements, already registered elements are updated
      */
-    bool update(PGE_EditSceneItem* obj);
+    void insertBulk(const ItemsList &objs) override;
+    bool update(PGE_EditSceneItem* obj) override;
+    void updateMany(const ItemsSet &objs, int64_t dx, int64_t dy) override;
+    UpdateCounters updateCounters() const override;
+    void resetUpdateCounters() override;
+    bool remove(PGE_EditSceneItem* obj) override;
+
+    bool query(const PGE_Rect<int64_t> &zone, t_resultCallback a_resultCallback, void *context) const override;
     /**
-     * @brief Unregister element from the tree without of destruction
-     * @param obj Pointer to an element
-     * @return true if no errors have occouped
+     * @brief Search elements in a specific area (inlined visitor, faster than the one of the common interface)
+     * @param zone Rectangular area to find elements
+     * @param visitor Callable object as bool(PGE_EditSceneItem*), return false from it to stop the search
+     * @return false if search was stopped by the visitor
      */
-    bool remove(PGE_EditSceneItem* obj);
+    template<class Visitor>
+    bool query(const PGE_Rect<int64_t> &zone, Visitor &&visitor) const;
+    void query(const PGE_Rect<int64_t> &zone, ItemsList *resultList) const override;
     /**
-     * @brief Unregister element from the tree and destroy it
-     * @param obj Pointer to element
-     * @return true if no errors have occouped
+     * @brief Search elements in a huge area on several threads of the global thread pool
+     * (the tree must not be changed until it returns)
+     * @param zone Rectangular area to find elements
+     * @param resultList List where found elements are will be appended (in no specific order)
      */
-    bool removeAndDestroy(PGE_EditSceneItem* obj);
+    void queryParallel(const PGE_Rect<int64_t> &zone, ItemsList *resultList) const override;
+    bool queryMany(const PGE_Rect<int64_t> *zones, int n, t_zoneResultCallback a_resultCallback, void *context) const override;
     /**
-     * @brief Clear tree without destruction of pointed objects (when there are held externally)
+     * @brief Search elements in several areas at once (for example, views of the same scene), upper nodes are walked once for all of them
+     * @param zones Array of rectangular areas to find elements
+     * @param n Count of areas in the array
+     * @param visitor Callable object as bool(PGE_EditSceneItem*, int zoneIndex), called once per area the element intersects, return false from it to stop the search
+     * @return false if search was stopped by the visitor
      */
-    void clear();
+    template<class Visitor>
+    bool queryMany(const PGE_Rect<int64_t> *zones, int n, Visitor &&visitor) const;
+    PGE_EditSceneItem *queryPoint(int64_t x, int64_t y) const override;
+    void nearest(int64_t x, int64_t y, int k, int64_t maxDistance, ItemsList *resultList) const override;
+    bool querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, t_resultCallback a_resultCallback, void *context) const override;
     /**
-     * @brief Clear and destroy all objects (when there are held inside of tree)
+     * @brief Search elements crossed by a line segment, in the order the segment enters them
+     * @param x1 Start position X
+     * @param y1 Start position Y
+     * @param x2 End position X (use a far point to cast a ray)
+     * @param y2 End position Y
+     * @param visitor Callable object as bool(PGE_EditSceneItem*), return false from it to stop the search
+     * @return false if search was stopped by the visitor
      */
-    void clearAndDestroy();
-
-    //! Search callback function
-    typedef bool (*t_resultCallback)(PGE_EditSceneItem*, void*);
-
+    template<class Visitor>
+    bool querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, Visitor &&visitor) const;
+    using PgeSceneIndex::querySegment;
+    /**
+     * @brief Count elements in a specific area, the subtrees inside of it are counted
+     * by the cached summaries of their nodes without visiting the elements
+     * @param zone Rectangular area to count elements
+     * @return Count of elements query() would find in the area
+     */
+    int countIn(const PGE_Rect<int64_t> &zone) const override;
+    /**
+     * @brief Find the bounding rectangle of elements in a specific area, the subtrees inside of it
+     * are taken from the cached summaries of their nodes (until removals make them too big,
+     * then the elements are visited until the next compaction step fixes them)
+     * @param zone Rectangular area to find elements
+     * @param bounds Rectangle where the united bounds of found elements will be written
+     * @return false if there are no elements in the area (bounds are left untouched then)
+     */
+    bool boundsIn(const PGE_Rect<int64_t> &zone, PGE_Rect<int64_t> *bounds) const override;
     /**
-     * @brief Search elements in a specific area
+     * @brief Search elements in a specific area down to the nodes smaller than a size, the subtrees of those
+     * are given at once by their cached summaries (to draw a level of detail when zoomed out)
      * @param zone Rectangular area to find elements
-     * @param a_resultCallback Callback function to return found elements
-     * @param context Any user data (for example, a pointer to the container where found items would be inserted)
+     * @param minNodeSize Nodes narrower than this are not walked into
+     * @param visitor Callable object as bool(PGE_EditSceneItem*) for the elements of the walked nodes
+     * @param cellVisitor Callable object as bool(const PGE_Rect<int64_t> &itemsRect, int itemsCount) for the subtrees
+     * of the small nodes (united bounds and count of all their elements, even the ones out of the area)
+     * @return false if search was stopped by one of the visitors
      */
-    void query(PGE_Rect<int64_t> &zone, t_resultCallback a_resultCallback, void *context) const;
+    template<class Visitor, class CellVisitor>
+    bool queryCoarse(const PGE_Rect<int64_t> &zone, int64_t minNodeSize, Visitor &&visitor, CellVisitor &&cellVisitor) const;
     /**
-     * @brief Get a set of all elements on the tree
-     * @return Set of elements on the tree
+     * @brief Visit the nodes of the tree in a specific area (for example, to draw them)
+     * @param zone Rectangular area to find nodes
+     * @param visitor Callable object as bool(const PGE_Rect<int64_t> &nodeRect, int depth, int itemsCount),
+     * parents go first, return false from it to skip the children of the node
      */
-    const ItemsSet & allItems() const;
+    template<class Visitor>
+    void queryNodes(const PGE_Rect<int64_t> &zone, Visitor &&visitor) const;
+    /**
+     * @brief Collect the statistics of the tree (walks all of it, meant for diagnostics)
+     * @return Shape of the tree and its memory
+     */
+    Stats stats() const;
+
     /**
-     * @brief Total count of elements in the tree
-     * @return Count of elements on the tree
+     * @brief Did removals leave empty nodes or mostly empty arrays in the tree?
      */
-    size_t count() const;
+    bool needsCompact() const override;
     /**
-     * @brief Is tree empty?
-     * @return true if tree is empty
+     * @brief Clean up the nodes passed by the budget: shrink their arrays, prune empty subtrees
+     * and relink too deep nodes (the next call goes on where this one has stopped)
      */
-    bool empty() const;
+    bool compactStep(int budget) override;
+
+protected:
+    void clearIndex(const ItemsList &items) override;
 };
 
+struct PgeQuadTree_private
+{
+    typedef loose_quadtree::LooseQuadtree<int64_t, PGE_EditSceneItem,
+                                          QTreePGE_Phys_ObjectExtractor,
+                                          QTreePGE_Phys_ObjectExtractor,
+                                          QTreePGE_Phys_ObjectExtractor> IndexTreeQ;
+    IndexTreeQ tree;
+};
+
+template<class Visitor>
+bool PgeQuadTree::query(const PGE_Rect<int64_t> &zone, Visitor &&visitor) const
+{
+    QReadLocker locker(&m_lock);
+    return p->tree.ForEachIntersecting(loose_quadtree::BoundingBox<int64_t>(zone.x(), zone.y(), zone.width(), zone.height()),
+                                       std::forward<Visitor>(visitor));
+}
+
+template<class Visitor>
+bool PgeQuadTree::queryMany(const PGE_Rect<int64_t> *zones, int n, Visitor &&visitor) const
+{
+    QReadLocker locker(&m_lock);
+    std::vector<loose_quadtree::BoundingBox<int64_t> > regions;
+    regions.reserve(n);
+    for(int i = 0; i < n; i++)
+        regions.emplace_back(zones[i].x(), zones[i].y(), zones[i].width(), zones[i].height());
+    return p->tree.ForEachIntersectingMany(regions.data(), n, std::forward<Visitor>(visitor));
+}
+
+template<class Visitor, class CellVisitor>
+bool PgeQuadTree::queryCoarse(const PGE_Rect<int64_t> &zone, int64_t minNodeSize, Visitor &&visitor, CellVisitor &&cellVisitor) const
+{
+    QReadLocker locker(&m_lock);
+    return p->tree.ForEachIntersectingCoarse(loose_quadtree::BoundingBox<int64_t>(zone.x(), zone.y(), zone.width(), zone.height()),
+                                             minNodeSize, std::forward<Visitor>(visitor),
+                                             [&cellVisitor](const loose_quadtree::BoundingBox<int64_t> &, int itemsCount,
+                                                            const loose_quadtree::BoundingBox<int64_t> &bounds)
+    {
+        return cellVisitor(PGE_Rect<int64_t>(bounds.left, bounds.top, bounds.width, bounds.height), itemsCount);
+    });
+}
+
+template<class Visitor>
+void PgeQuadTree::queryNodes(const PGE_Rect<int64_t> &zone, Visitor &&visitor) const
+{
+    QReadLocker locker(&m_lock);
+    p->tree.ForEachNode(loose_quadtree::BoundingBox<int64_t>(zone.x(), zone.y(), zone.width(), zone.height()),
+                        [&visitor](const loose_quadtree::BoundingBox<int64_t> &bounds, int depth, int itemsCount)
+    {
+        return visitor(PGE_Rect<int64_t>(bounds.left, bounds.top, bounds.width, bounds.height), depth, itemsCount);
+    });
+}
+
+template<class Visitor>
+bool PgeQuadTree::querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, Visitor &&visitor) const
+{
+    QReadLocker locker(&m_lock);
+    return p->tree.ForEachOnSegment(x1, y1, x2, y2, std::forward<Visitor>(visitor));
+}
+
 #endif // LVL_QUAD_TREE_H
 
@@ -0,0 +1,173 @@
+#include "pge_scene_index.h"
+#include "pge_edit_scene_item.h"
+
+PgeSceneIndex::PgeSceneIndex()
+{}
+
+PgeSceneIndex::~PgeSceneIndex()
+{}
+
+bool PgeSceneIndex::addItem(PGE_EditSceneItem *obj)
+{
+    if(obj->m_treeSlot >= 0)
+        return false;
+    obj->m_treeSlot = m_items.size();
+    obj->m_zSeq = ++m_lastZSeq;
+    m_items.push_back(obj);
+    return true;
+}
+
+void PgeSceneIndex::removeItem(PGE_EditSceneItem *obj)
+{
+    if(obj->m_treeSlot < 0)
+        return;
+    PGE_EditSceneItem *last = m_items.last();
+    m_items[obj->m_treeSlot] = last;
+    last->m_treeSlot = obj->m_treeSlot;
+    m_items.removeLast();
+    obj->m_treeSlot = -1;
+}
+
+void PgeSceneIndex::reserveItems(int count)
+{
+    m_items.reserve(m_items.size() + count);
+}
+
+PgeSceneIndex::ItemsList PgeSceneIndex::takeItems()
+{
+    ItemsList taken;
+    taken.swap(m_items);
+    for(PGE_EditSceneItem *obj : taken)
+        obj->m_treeSlot = -1;
+    return taken;
+}
+
+bool PgeSceneIndex::removeAndDestroy(PGE_EditSceneItem *obj)
+{
+    if(!obj)
+        return false;
+    bool ret = remove(obj);
+    delete obj;
+    return ret;
+}
+
+void PgeSceneIndex::clear()
+{
+    QWriteLocker locker(&m_lock);
+    clearIndex(takeItems());
+}
+
+void PgeSceneIndex::clearAndDestroy()
+{
+    QWriteLocker locker(&m_lock);
+    ItemsList killList = takeItems();
+    clearIndex(killList);
+    locker.unlock();
+    for(PGE_EditSceneItem *it : killList)
+        delete it;
+}
+
+void PgeSceneIndex::query(const PGE_Rect<int64_t> &zone, PgeSceneIndex::ItemsList *resultList) const
+{
+    query(zone, [resultList](PGE_EditSceneItem *item)
+    {
+        resultList->push_back(item);
+        return true;
+    });
+}
+
+void PgeSceneIndex::queryParallel(const PGE_Rect<int64_t> &zone, PgeSceneIndex::ItemsList *resultList) const
+{
+    query(zone, resultList);
+}
+
+void PgeSceneIndex::querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, PgeSceneIndex::ItemsList *resultList) const
+{
+    querySegment(x1, y1, x2, y2, [resultList](PGE_EditSceneItem *item)
+    {
+        resultList->push_back(item);
+        return true;
+    });
+}
+
+PGE_EditSceneItem *PgeSceneIndex::firstOnSegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2) const
+{
+    PGE_EditSceneItem *first = nullptr;
+    querySegment(x1, y1, x2, y2, [&first](PGE_EditSceneItem *item)
+    {
+        first = item;
+        return false;
+    });
+    return first;
+}
+
+int PgeSceneIndex::countIn(const PGE_Rect<int64_t> &zone) const
+{
+    int found = 0;
+    query(zone, [&found](PGE_EditSceneItem *)
+    {
+        found++;
+        return true;
+    });
+    return found;
+}
+
+bool PgeSceneIndex::boundsIn(const PGE_Rect<int64_t> &zone, PGE_Rect<int64_t> *bounds) const
+{
+    bool found = false;
+    PGE_Rect<int64_t> united;
+    query(zone, [&found, &united](PGE_EditSceneItem *item)
+    {
+        PGE_Rect<int64_t> r = item->boundingRectI();
+        if(!found)
+        {
+            united = r;
+            found = true;
+            return true;
+        }
+        united.expendLeft(r.left());
+        united.expendTop(r.top());
+        united.expendRight(r.right());
+        united.expendBottom(r.bottom());
+        return true;
+    });
+    if(found)
+        *bounds = united;
+    return found;
+}
+
+PgeSceneIndex::ItemsList PgeSceneIndex::allItems() const
+{
+    QReadLocker locker(&m_lock);
+    return m_items;
+}
+
+size_t PgeSceneIndex::count() const
+{
+    QReadLocker locker(&m_lock);
+    return (size_t)m_items.size();
+}
+
+bool PgeSceneIndex::empty() const
+{
+    QReadLocker locker(&m_lock);
+    return m_items.isEmpty();
+}
+
+bool PgeSceneIndex::needsOptimize() const
+{
+    return false;
+}
+
+void PgeSceneIndex::optimize()
+{}
+
+bool PgeSceneIndex::needsCompact() const
+{
+    return false;
+}
+
+bool PgeSceneIndex::compactStep(int /*budget*/)
+{
+    return true;
+}
@@ -0,0 +1,325 @@
+#ifndef PGE_SCENE_INDEX_H
+#define PGE_SCENE_INDEX_H
+
+#include "pge_rect.h"
+#include <type_traits>
+#include <utility>
+#include <QSet>
+#include <QVector>
+#include <QReadWriteLock>
+
+class PGE_EditSceneItem;
+
+/**
+ * @brief Spatial index of the scene elements, common interface of all backends
+ *
+ * Every call is done as a whole under the lock of the index, so one thread can insert
+ * (for example, a level loader with insertBulk() per chunk) while others query it:
+ * they see the index as it was before or after each of the calls. Visitors of queries
+ * must not change the index.
+ */
+class PgeSceneIndex
+{
+public:
+    typedef QSet<PGE_EditSceneItem* > ItemsSet;
+    typedef QVector<PGE_EditSceneItem* > ItemsList;
+    //! Statistics of position updates
+    struct UpdateCounters
+    {
+        //! Elements which were kept in their node
+        int64_t inPlace = 0;
+        //! Elements which were moved into another node
+        int64_t relinked = 0;
+    };
+    //! Search callback function
+    typedef bool (*t_resultCallback)(PGE_EditSceneItem*, void*);
+    //! Search callback function of multiple areas, also gets an index of the area
+    typedef bool (*t_zoneResultCallback)(PGE_EditSceneItem*, int, void*);
+
+    PgeSceneIndex();
+    PgeSceneIndex(const PgeSceneIndex &qt) = delete;
+    virtual ~PgeSceneIndex();
+
+    /**
+     * @brief Insert element into the index
+     * @param obj Pointer to an element
+     * @return true if success
+     */
+    virtual bool insert(PGE_EditSceneItem* obj) = 0;
+    /**
+     * @brief Insert a lot of elements at once (use it for level loading,
+     * queries of other threads wait for the whole list, so give it in chunks to let them see the progress)
+     * @param objs List of elements, already registered elements are updated
+     */
+    virtual void insertBulk(const ItemsList &objs) = 0;
+    /**
+     * @brief Update element's position inside of the index
+     * @param obj Pointer to an element
+     * @return true if success
+     */
+    virtual bool update(PGE_EditSceneItem* obj) = 0;
+    /**
+     * @brief Move multiple elements by the same offset and update their positions inside of the index
+     * @param objs Set of registered elements
+     * @param dx Offset X
+     * @param dy Offset Y
+     */
+    virtual void updateMany(const ItemsSet &objs, int64_t dx, int64_t dy) = 0;
+    /**
+     * @brief Statistics of update() calls since the last reset
+     * @return Counts of in-place and relinking updates
+     */
+    virtual UpdateCounters updateCounters() const = 0;
+    /**
+     * @brief Reset the statistics of update() calls
+     */
+    virtual void resetUpdateCounters() = 0;
+    /**
+     * @brief Unregister element from the index without of destruction
+     * @param obj Pointer to an element
+     * @return true if no errors have occouped
+     */
+    virtual bool remove(PGE_EditSceneItem* obj) = 0;
+    /**
+     * @brief Unregister element from the index and destroy it
+     * @param obj Pointer to element
+     * @return true if no errors have occouped
+     */
+    bool removeAndDestroy(PGE_EditSceneItem* obj);
+    /**
+     * @brief Clear index without destruction of pointed objects (when there are held externally)
+     */
+    void clear();
+    /**
+     * @brief Clear and destroy all objects (when there are held inside of index)
+     */
+    void clearAndDestroy();
+
+    /**
+     * @brief Search elements in a specific area
+     * @param zone Rectangular area to find elements
+     * @param a_resultCallback Callback function to return found elements (return false from it to stop the search)
+     * @param context Any user data (for example, a pointer to the container where found items would be inserted)
+     * @return false if search was stopped by the callback
+     */
+    virtual bool query(const PGE_Rect<int64_t> &zone, t_resultCallback a_resultCallback, void *context) const = 0;
+    /**
+     * @brief Search elements in a specific area
+     * @param zone Rectangular area to find elements
+     * @param visitor Callable object as bool(PGE_EditSceneItem*), return false from it to stop the search
+     * @return false if search was stopped by the visitor
+     */
+    template<class Visitor>
+    bool query(const PGE_Rect<int64_t> &zone, Visitor &&visitor) const;
+    /**
+     * @brief Search elements in a specific area
+     * @param zone Rectangular area to find elements
+     * @param resultList List where found elements are will be appended (reuse it to avoid allocations)
+     */
+    virtual void query(const PGE_Rect<int64_t> &zone, ItemsList *resultList) const;
+    /**
+     * @brief Search elements in a huge area, on several threads if the backend can do that
+     * (the index must not be changed until it returns)
+     * @param zone Rectangular area to find elements
+     * @param resultList List where found elements are will be appended (in no specific order)
+     */
+    virtual void queryParallel(const PGE_Rect<int64_t> &zone, ItemsList *resultList) const;
+    /**
+     * @brief Search elements in several areas at once (for example, views of the same scene)
+     * @param zones Array of rectangular areas to find elements
+     * @param n Count of areas in the array
+     * @param a_resultCallback Callback function called once per area the element intersects (return false from it to stop the search)
+     * @param context Any user data
+     * @return false if search was stopped by the callback
+     */
+    virtual bool queryMany(const PGE_Rect<int64_t> *zones, int n, t_zoneResultCallback a_resultCallback, void *context) const = 0;
+    /**
+     * @brief Search elements in several areas at once (for example, views of the same scene)
+     * @param zones Array of rectangular areas to find elements
+     * @param n Count of areas in the array
+     * @param visitor Callable object as bool(PGE_EditSceneItem*, int zoneIndex), called once per area the element intersects, return false from it to stop the search
+     * @return false if search was stopped by the visitor
+     */
+    template<class Visitor>
+    bool queryMany(const PGE_Rect<int64_t> *zones, int n, Visitor &&visitor) const;
+    /**
+     * @brief Find the element at a specific point
+     * @param x Position X
+     * @param y Position Y
+     * @return Topmost (the highest z-order) element which contains the point, or nullptr
+     */
+    virtual PGE_EditSceneItem *queryPoint(int64_t x, int64_t y) const = 0;
+    /**
+     * @brief Find elements nearest to a specific point (distance to their bounding rectangles)
+     * @param x Position X
+     * @param y Position Y
+     * @param k Maximal count of elements to find
+     * @param maxDistance Elements farther than this are ignored
+     * @param resultList List where found elements are will be appended, nearest first
+     */
+    virtual void nearest(int64_t x, int64_t y, int k, int64_t maxDistance, ItemsList *resultList) const = 0;
+    /**
+     * @brief Search elements crossed by a line segment, in the order the segment enters them
+     * @param x1 Start position X
+     * @param y1 Start position Y
+     * @param x2 End position X (use a far point to cast a ray)
+     * @param y2 End position Y
+     * @param a_resultCallback Callback function to return found elements (return false from it to stop the search)
+     * @param context Any user data
+     * @return false if search was stopped by the callback
+     */
+    virtual bool querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, t_resultCallback a_resultCallback, void *context) const = 0;
+    /**
+     * @brief Search elements crossed by a line segment, in the order the segment enters them
+     * @param x1 Start position X
+     * @param y1 Start position Y
+     * @param x2 End position X (use a far point to cast a ray)
+     * @param y2 End position Y
+     * @param visitor Callable object as bool(PGE_EditSceneItem*), return false from it to stop the search
+     * @return false if search was stopped by the visitor
+     */
+    template<class Visitor>
+    bool querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, Visitor &&visitor) const;
+    /**
+     * @brief Search elements crossed by a line segment, in the order the segment enters them
+     * @param x1 Start position X
+     * @param y1 Start position Y
+     * @param x2 End position X
+     * @param y2 End position Y
+     * @param resultList List where found elements are will be appended
+     */
+    virtual void querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, ItemsList *resultList) const;
+    /**
+     * @brief Find the first element crossed by a line segment
+     * @param x1 Start position X
+     * @param y1 Start position Y
+     * @param x2 End position X
+     * @param y2 End position Y
+     * @return The nearest element to the start of the segment which is crossed by it, or nullptr
+     */
+    virtual PGE_EditSceneItem *firstOnSegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2) const;
+    /**
+     * @brief Count elements in a specific area without collecting them
+     * @param zone Rectangular area to count elements
+     * @return Count of elements query() would find in the area
+     */
+    virtual int countIn(const PGE_Rect<int64_t> &zone) const;
+    /**
+     * @brief Find the bounding rectangle of elements in a specific area without collecting them
+     * @param zone Rectangular area to find elements
+     * @param bounds Rectangle where the united bounds of found elements will be written
+     * @return false if there are no elements in the area (bounds are left untouched then)
+     */
+    virtual bool boundsIn(const PGE_Rect<int64_t> &zone, PGE_Rect<int64_t> *bounds) const;
+    /**
+     * @brief Get a list of all elements on the index
+     * @return List of elements on the index (in no specific order)
+     */
+    ItemsList allItems() const;
+    /**
+     * @brief Total count of elements in the index
+     * @return Count of elements on the index
+     */
+    size_t count() const;
+    /**
+     * @brief Is index empty?
+     * @return true if index is empty
+     */
+    bool empty() const;
+
+    /**
+     * @brief Are there changes which optimize() would fold into a faster structure?
+     * @return true if the scene should call optimize() when the user is idle
+     */
+    virtual bool needsOptimize() const;
+    /**
+     * @brief Rebuild the index after changes (may take a while on big levels, call it when the user is idle)
+     */
+    virtual void optimize();
+    /**
+     * @brief Are there removed elements which still take place in the index?
+     * @return true if the scene should call compactStep() until it's done
+     */
+    virtual bool needsCompact() const;
+    /**
+     * @brief Do a part of the index compaction, it goes on with the next call
+     * @param budget Count of elements to pass at most (keeps one call short enough for idle times)
+     * @return true if there is nothing more to compact
+     */
+    virtual bool compactStep(int budget);
+
+protected:
+    /**
+     * @brief Add element into the list of all elements (if it's not there yet) and give it the next z-order
+     * @param obj Pointer to an element
+     * @return true if element was not registered before
+     */
+    bool addItem(PGE_EditSceneItem *obj);
+    /**
+     * @brief Remove element from the list of all elements
+     * @param obj Pointer to an element
+     */
+    void removeItem(PGE_EditSceneItem *obj);
+    /**
+     * @brief Reserve the list of all elements for more elements
+     * @param count Count of elements which are going to be added
+     */
+    void reserveItems(int count);
+    /**
+     * @brief List of all elements, the lock must be held by the caller
+     * (a thread which holds the write lock can't take the read lock, use it instead of allItems())
+     * @return Dense list of all elements
+     */
+    const ItemsList &items() const
+    {
+        return m_items;
+    }
+    /**
+     * @brief Drop the index structure of the backend, the list of all elements is already empty
+     * @param items Elements which were registered
+     */
+    virtual void clearIndex(const ItemsList &items) = 0;
+
+    //! Queries are reading under it, changes are writing (recursive, so queries can be nested)
+    mutable QReadWriteLock m_lock{QReadWriteLock::Recursive};
+
+private:
+    ItemsList takeItems();
+
+    //! Dense list of all elements, every element keeps its index in m_treeSlot
+    ItemsList m_items;
+    //! Insertion sequence number of the latest registered element
+    uint32_t m_lastZSeq = 0;
+};
+
+template<class Visitor>
+bool PgeSceneIndex::query(const PGE_Rect<int64_t> &zone, Visitor &&visitor) const
+{
+    typedef typename std::remove_reference<Visitor>::type VisitorT;
+    return query(zone, [](PGE_EditSceneItem *item, void *context)
+    {
+        return (*static_cast<VisitorT *>(context))(item);
+    }, const_cast<void *>(static_cast<const void *>(&visitor)));
+}
+
+template<class Visitor>
+bool PgeSceneIndex::queryMany(const PGE_Rect<int64_t> *zones, int n, Visitor &&visitor) const
+{
+    typedef typename std::remove_reference<Visitor>::type VisitorT;
+    return queryMany(zones, n, [](PGE_EditSceneItem *item, int zone, void *context)
+    {
+        return (*static_cast<VisitorT *>(context))(item, zone);
+    }, const_cast<void *>(static_cast<const void *>(&visitor)));
+}
+
+template<class Visitor>
+bool PgeSceneIndex::querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, Visitor &&visitor) const
+{
+    typedef typename std::remove_reference<Visitor>::type VisitorT;
+    return querySegment(x1, y1, x2, y2, [](PGE_EditSceneItem *item, void *context)
+    {
+        return (*static_cast<VisitorT *>(context))(item);
+    }, const_cast<void *>(static_cast<const void *>(&visitor)));
+}
+
+#endif // PGE_SCENE_INDEX_H
@@ -0,0 +1,476 @@
+#include "pge_tile_grid.h"
+#include "pge_edit_scene_item.h"
+#include "LooseQuadtree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <utility>
+#include <vector>
+
+//! Size of a chunk: 16x16 tiles of 32 pixels
+static const int64_t c_chunkSize = 16 * 32;
+
+PgeTileGrid::PgeTileGrid()
+{}
+
+PgeTileGrid::~PgeTileGrid()
+{}
+
+PgeTileGrid::Entry PgeTileGrid::makeEntry(PGE_EditSceneItem *obj)
+{
+    PGE_Rect<int64_t> r = obj->boundingRectI();
+    Entry e;
+    e.left = r.x();
+    e.top = r.y();
+    e.width = r.width();
+    e.height = r.height();
+    e.item = obj;
+    return e;
+}
+
+bool PgeTileGrid::isOversized(const PgeTileGrid::Entry &e)
+{
+    return e.width > c_chunkSize || e.height > c_chunkSize;
+}
+
+int64_t PgeTileGrid::chunkCoord(int64_t v)
+{
+    // rounded down, so the chunk of -1 is -1
+    return v >= 0 ? v / c_chunkSize : -((-(v + 1)) / c_chunkSize) - 1;
+}
+
+quint64 PgeTileGrid::chunkKey(int64_t chunkX, int64_t chunkY)
+{
+    // 32 bits of each coordinate are more than any level needs, far chunks may share a key,
+    // that's fine as every entry is checked by its rectangle anyway
+    return (quint64(quint32(chunkX)) << 32) | quint64(quint32(chunkY));
+}
+
+void PgeTileGrid::place(const PgeTileGrid::Entry &e)
+{
+    PgeTileGridHandle &h = e.item->m_gridHandle;
+    h.oversized = isOversized(e);
+    if(h.oversized)
+    {
+        h.slot = m_oversized.size();
+        m_oversized.push_back(e);
+        return;
+    }
+
+    int64_t cx = chunkCoord(e.left);
+    int64_t cy = chunkCoord(e.top);
+    h.chunk = chunkKey(cx, cy);
+    Chunk &chunk = m_chunks[h.chunk];
+    h.slot = chunk.size();
+    chunk.push_back(e);
+    m_maxWidth = std::max(m_maxWidth, e.width);
+    m_maxHeight = std::max(m_maxHeight, e.height);
+
+    if(m_minChunkX > m_maxChunkX)
+    {
+        m_minChunkX = m_maxChunkX = cx;
+        m_minChunkY = m_maxChunkY = cy;
+    }
+    else
+    {
+        m_minChunkX = std::min(m_minChunkX, cx);
+        m_maxChunkX = std::max(m_maxChunkX, cx);
+        m_minChunkY = std::min(m_minChunkY, cy);
+        m_maxChunkY = std::max(m_maxChunkY, cy);
+    }
+}
+
+void PgeTileGrid::unplace(PGE_EditSceneItem *obj)
+{
+    PgeTileGridHandle &h = obj->m_gridHandle;
+    Q_ASSERT(h.slot >= 0);
+    QHash<quint64, Chunk>::iterator it = m_chunks.end();
+    Chunk *chunk = &m_oversized;
+    if(!h.oversized)
+    {
+        it = m_chunks.find(h.chunk);
+        Q_ASSERT(it != m_chunks.end());
+        chunk = &it.value();
+    }
+
+    // The last entry takes the place of the removed one
+    Entry &last = chunk->last();
+    last.item->m_gridHandle.slot = h.slot;
+    (*chunk)[h.slot] = last;
+    chunk->removeLast();
+    if(chunk->isEmpty() && !h.oversized)
+        m_chunks.erase(it);
+    h.slot = -1;
+}
+
+bool PgeTileGrid::insertOne(PGE_EditSceneItem *obj)
+{
+    if(!addItem(obj))
+    {
+        updateOne(obj);
+        return false;
+    }
+    place(makeEntry(obj));
+    return true;
+}
+
+bool PgeTileGrid::updateOne(PGE_EditSceneItem *obj)
+{
+    if(addItem(obj))
+    {
+        place(makeEntry(obj));
+        return true;
+    }
+
+    Entry e = makeEntry(obj);
+    PgeTileGridHandle &h = obj->m_gridHandle;
+    bool oversized = isOversized(e);
+    if(oversized && h.oversized)
+    {
+        m_oversized[h.slot] = e;
+        m_counters.inPlace++;
+    }
+    else if(!oversized && !h.oversized && h.chunk == chunkKey(chunkCoord(e.left), chunkCoord(e.top)))
+    {
+        m_chunks[h.chunk][h.slot] = e;
+        m_counters.inPlace++;
+    }
+    else
+    {
+        unplace(obj);
+        place(e);
+        m_counters.relinked++;
+    }
+    return true;
+}
+
+bool PgeTileGrid::insert(PGE_EditSceneItem *obj)
+{
+    QWriteLocker locker(&m_lock);
+    return insertOne(obj);
+}
+
+void PgeTileGrid::insertBulk(const PgeTileGrid::ItemsList &objs)
+{
+    QWriteLocker locker(&m_lock);
+    reserveItems(objs.size());
+    for(PGE_EditSceneItem *obj : objs)
+        insertOne(obj);
+}
+
+bool PgeTileGrid::update(PGE_EditSceneItem *obj)
+{
+    QWriteLocker locker(&m_lock);
+    return updateOne(obj);
+}
+
+void PgeTileGrid::updateMany(const PgeTileGrid::ItemsSet &objs, int64_t dx, int64_t dy)
+{
+    QWriteLocker locker(&m_lock);
+    for(PGE_EditSceneItem *obj : objs)
+    {
+        obj->m_posRect.moveBy(dx, dy);
+        updateOne(obj);
+    }
+}
+
+PgeTileGrid::UpdateCounters PgeTileGrid::updateCounters() const
+{
+    QReadLocker locker(&m_lock);
+    return m_counters;
+}
+
+void PgeTileGrid::resetUpdateCounters()
+{
+    QWriteLocker locker(&m_lock);
+    m_counters = UpdateCounters();
+}
+
+bool PgeTileGrid::remove(PGE_EditSceneItem *obj)
+{
+    if(!obj)
+        return false;
+    QWriteLocker locker(&m_lock);
+    if(obj->m_gridHandle.slot < 0)
+        return false;
+    unplace(obj);
+    removeItem(obj);
+    return true;
+}
+
+void PgeTileGrid::clearIndex(const PgeTileGrid::ItemsList &items)
+{
+    for(PGE_EditSceneItem *obj : items)
+        obj->m_gridHandle.slot = -1;
+    m_chunks.clear();
+    m_oversized.clear();
+    m_minChunkX = m_minChunkY = 0;
+    m_maxChunkX = m_maxChunkY = -1;
+    m_maxWidth = m_maxHeight = 0;
+}
+
+template<class Visitor>
+bool PgeTileGrid::forEachCandidate(int64_t left, int64_t top, int64_t right, int64_t bottom, Visitor &&visitor) const
+{
+    for(const Entry &e : m_oversized)
+    {
+        if(!visitor(e))
+            return false;
+    }
+
+    // Elements can start before the area and still reach into it
+    int64_t cx1 = std::max(chunkCoord(left - m_maxWidth), m_minChunkX);
+    int64_t cy1 = std::max(chunkCoord(top - m_maxHeight), m_minChunkY);
+    int64_t cx2 = std::min(chunkCoord(right), m_maxChunkX);
+    int64_t cy2 = std::min(chunkCoord(bottom), m_maxChunkY);
+    if(cx1 > cx2 || cy1 > cy2)
+        return true;
+
+    if(double(cx2 - cx1 + 1) * double(cy2 - cy1 + 1) > double(m_chunks.size()))
+    {
+        // Most of the area is empty, it's cheaper to look at every chunk there is
+        for(QHash<quint64, Chunk>::const_iterator it = m_chunks.constBegin(); it != m_chunks.constEnd(); ++it)
+        {
+            for(const Entry &e : it.value())
+            {
+                if(!visitor(e))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    for(int64_t cy = cy1; cy <= cy2; cy++)
+    {
+        for(int64_t cx = cx1; cx <= cx2; cx++)
+        {
+            QHash<quint64, Chunk>::const_iterator it = m_chunks.constFind(chunkKey(cx, cy));
+            if(it == m_chunks.constEnd())
+                continue;
+            for(const Entry &e : it.value())
+            {
+                if(!visitor(e))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+template<class Visitor>
+bool PgeTileGrid::forEachIntersecting(const PGE_Rect<int64_t> &zone, Visitor &&visitor) const
+{
+    const int64_t left = zone.x();
+    const int64_t top = zone.y();
+    const int64_t right = zone.x() + zone.width();
+    const int64_t bottom = zone.y() + zone.height();
+    return forEachCandidate(left, top, std::max(right - 1, left), std::max(bottom - 1, top),
+                            [&](const Entry &e)
+    {
+        if(e.left + e.width <= left || right <= e.left ||
+           e.top + e.height <= top || bottom <= e.top)
+            return true;
+        return visitor(e.item);
+    });
+}
+
+bool PgeTileGrid::query(const PGE_Rect<int64_t> &zone, PgeTileGrid::t_resultCallback a_resultCallback, void *context) const
+{
+    QReadLocker locker(&m_lock);
+    return forEachIntersecting(zone, [a_resultCallback, context](PGE_EditSceneItem *item)
+    {
+        return a_resultCallback(item, context);
+    });
+}
+
+void PgeTileGrid::query(const PGE_Rect<int64_t> &zone, PgeTileGrid::ItemsList *resultList) const
+{
+    QReadLocker locker(&m_lock);
+    forEachIntersecting(zone, [resultList](PGE_EditSceneItem *item)
+    {
+        resultList->push_back(item);
+        return true;
+    });
+}
+
+bool PgeTileGrid::queryMany(const PGE_Rect<int64_t> *zones, int n, PgeTileGrid::t_zoneResultCallback a_resultCallback, void *context) const
+{
+    QReadLocker locker(&m_lock);
+    for(int i = 0; i < n; i++)
+    {
+        bool goOn = forEachIntersecting(zones[i], [a_resultCallback, context, i](PGE_EditSceneItem *item)
+        {
+            return a_resultCallback(item, i, context);
+        });
+        if(!goOn)
+            return false;
+    }
+    return true;
+}
+
+PGE_EditSceneItem *PgeTileGrid::queryPoint(int64_t x, int64_t y) const
+{
+    QReadLocker locker(&m_lock);
+    PGE_EditSceneItem *topmost = nullptr;
+    forEachCandidate(x, y, x, y, [x, y, &topmost](const Entry &e)
+    {
+        if(e.left <= x && x < e.left + e.width && e.top <= y && y < e.top + e.height &&
+           (!topmost || e.item->zOrder() > topmost->zOrder()))
+            topmost = e.item;
+        return true;
+    });
+    return topmost;
+}
+
+void PgeTileGrid::nearest(int64_t x, int64_t y, int k, int64_t maxDistance, PgeTileGrid::ItemsList *resultList) const
+{
+    QReadLocker locker(&m_lock);
+    if(k <= 0)
+        return;
+
+    // The k nearest so far, the farthest of them on the top
+    typedef std::pair<double, PGE_EditSceneItem *> Candidate;
+    std::priority_queue<Candidate> best;
+    const double limit = double(maxDistance) * double(maxDistance);
+    auto consider = [&](const Entry &e)
+    {
+        double d = loose_quadtree::detail::SquaredDistance(loose_quadtree::BoundingBox<int64_t>(e.left, e.top, e.width, e.height), x, y);
+        if(d > limit)
+            return true;
+        if(int(best.size()) < k)
+            best.push(Candidate(d, e.item));
+        else if(d < best.top().first)
+        {
+            best.pop();
+            best.push(Candidate(d, e.item));
+        }
+        return true;
+    };
+
+    for(const Entry &e : m_oversized)
+        consider(e);
+
+    // Rings of chunks around the point's one, elements of the ring r and farther start
+    // outside of the inner square and can reach back into it only by their size
+    const int64_t pcx = chunkCoord(x);
+    const int64_t pcy = chunkCoord(y);
+    const int64_t lastRing = m_minChunkX > m_maxChunkX ? -1 : std::max(std::max(pcx - m_minChunkX, m_maxChunkX - pcx),
+                                      std::max(pcy - m_minChunkY, m_maxChunkY - pcy));
+    auto visitChunk = [&](int64_t cx, int64_t cy)
+    {
+        QHash<quint64, Chunk>::const_iterator it = m_chunks.constFind(chunkKey(cx, cy));
+        if(it == m_chunks.constEnd())
+            return;
+        for(const Entry &e : it.value())
+            consider(e);
+    };
+    for(int64_t r = 0; r <= lastRing; r++)
+    {
+        double bound = 0.0;
+        if(r > 0)
+        {
+            double lowX = double(x) - double((pcx - r + 1) * c_chunkSize + m_maxWidth);
+            double lowY = double(y) - double((pcy - r + 1) * c_chunkSize + m_maxHeight);
+            double highX = double((pcx + r) * c_chunkSize) - double(x);
+            double highY = double((pcy + r) * c_chunkSize) - double(y);
+            bound = std::max(0.0, std::min(std::min(lowX, lowY), std::min(highX, highY)));
+        }
+        if(bound * bound > limit)
+            break;
+        if(int(best.size()) == k && bound * bound > best.top().first)
+            break;
+        // Only the part of the ring which overlaps the used chunks
+        int64_t cx1 = std::max(pcx - r, m_minChunkX);
+        int64_t cx2 = std::min(pcx + r, m_maxChunkX);
+        int64_t cy1 = std::max(pcy - r + 1, m_minChunkY);
+        int64_t cy2 = std::min(pcy + r - 1, m_maxChunkY);
+        for(int64_t cx = cx1; cx <= cx2; cx++)
+        {
+            visitChunk(cx, pcy - r);
+            if(r > 0)
+                visitChunk(cx, pcy + r);
+        }
+        if(r == 0)
+            continue;
+        for(int64_t cy = cy1; cy <= cy2; cy++)
+        {
+            if(pcx - r >= m_minChunkX)
+                visitChunk(pcx - r, cy);
+            if(pcx + r <= m_maxChunkX)
+                visitChunk(pcx + r, cy);
+        }
+    }
+
+    std::vector<Candidate> found;
+    found.reserve(best.size());
+    for(; !best.empty(); best.pop())
+        found.push_back(best.top());
+    for(auto it = found.rbegin(); it != found.rend(); ++it)
+        resultList->push_back(it->second);
+}
+
+bool PgeTileGrid::querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, PgeTileGrid::t_resultCallback a_resultCallback, void *context) const
+{
+    QReadLocker locker(&m_lock);
+    typedef std::pair<double, PGE_EditSceneItem *> Hit;
+    std::vector<Hit> hits;
+    auto check = [&](const Entry &e)
+    {
+        double entry;
+        if(loose_quadtree::detail::SegmentEntry(loose_quadtree::BoundingBox<int64_t>(e.left, e.top, e.width, e.height), x1, y1, x2, y2, &entry))
+            hits.push_back(Hit(entry, e.item));
+        return true;
+    };
+
+    for(const Entry &e : m_oversized)
+        check(e);
+
+    // Row by row of chunks, only the columns under the part of the segment which
+    // crosses the elements starting in that row (they reach further by their size)
+    const int64_t rowFirst = std::max(chunkCoord(std::min(y1, y2) - m_maxHeight), m_minChunkY);
+    const int64_t rowLast = std::min(chunkCoord(std::max(y1, y2)), m_maxChunkY);
+    const double dy = double(y2) - double(y1);
+    for(int64_t cy = rowFirst; cy <= rowLast; cy++)
+    {
+        double low = double(cy) * double(c_chunkSize);
+        double high = low + double(c_chunkSize) + double(m_maxHeight);
+        double t1 = 0.0, t2 = 1.0;
+        if(dy != 0.0)
+        {
+            t1 = (low - double(y1)) / dy;
+            t2 = (high - double(y1)) / dy;
+            if(t1 > t2)
+                std::swap(t1, t2);
+            t1 = std::max(t1, 0.0);
+            t2 = std::min(t2, 1.0);
+            if(t1 > t2)
+                continue;
+        }
+        double xa = double(x1) + (double(x2) - double(x1)) * t1;
+        double xb = double(x1) + (double(x2) - double(x1)) * t2;
+        if(xa > xb)
+            std::swap(xa, xb);
+        int64_t cx1 = std::max(chunkCoord(int64_t(std::floor(xa)) - m_maxWidth), m_minChunkX);
+        int64_t cx2 = std::min(chunkCoord(int64_t(std::ceil(xb))), m_maxChunkX);
+        for(int64_t cx = cx1; cx <= cx2; cx++)
+        {
+            QHash<quint64, Chunk>::const_iterator it = m_chunks.constFind(chunkKey(cx, cy));
+            if(it == m_chunks.constEnd())
+                continue;
+            for(const Entry &e : it.value())
+                check(e);
+        }
+    }
+
+    std::sort(hits.begin(), hits.end(), [](const Hit &a, const Hit &b)
+    {
+        return a.first < b.first;
+    });
+    for(const Hit &hit : hits)
+    {
+        if(!a_resultCallback(hit.second, context))
+            return false;
+    }
+    return true;
+}
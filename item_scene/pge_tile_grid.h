@@ -0,0 +1,106 @@
+#ifndef PGE_TILE_GRID_H
+#define PGE_TILE_GRID_H
+
+#include "pge_rect.h"
+#include "pge_scene_index.h"
+#include <QHash>
+#include <QVector>
+
+//! Place of an element inside of PgeTileGrid
+struct PgeTileGridHandle
+{
+    //! Key of the chunk (unused for oversized elements)
+    quint64 chunk = 0;
+    //! Index inside of the chunk (or of the list of oversized elements), -1 if not in the grid
+    int slot = -1;
+    //! Element is larger than a chunk and is kept in a separate list
+    bool oversized = false;
+};
+
+/**
+ * @brief Spatial index on a sparse grid of chunks, made for tile-aligned content
+ *
+ * Space is split into chunks of 16x16 tiles of 32 pixels. An element is kept in the flat
+ * array of the chunk which contains its top-left corner, together with a copy of its
+ * bounding rectangle, so queries scan arrays instead of following pointers. Elements
+ * larger than a chunk are kept in a separate list which every query scans. Insert,
+ * update and remove are O(1), an area query scans the chunks under it plus the ones
+ * before it where the elements which reach into the area can start.
+ */
+class PgeTileGrid : public PgeSceneIndex
+{
+public:
+    PgeTileGrid();
+    PgeTileGrid(const PgeTileGrid &qt) = delete;
+    ~PgeTileGrid();
+
+    bool insert(PGE_EditSceneItem* obj) override;
+    void insertBulk(const ItemsList &objs) override;
+    bool update(PGE_EditSceneItem* obj) override;
+    void updateMany(const ItemsSet &objs, int64_t dx, int64_t dy) override;
+    UpdateCounters updateCounters() const override;
+    void resetUpdateCounters() override;
+    bool remove(PGE_EditSceneItem* obj) override;
+
+    bool query(const PGE_Rect<int64_t> &zone, t_resultCallback a_resultCallback, void *context) const override;
+    void query(const PGE_Rect<int64_t> &zone, ItemsList *resultList) const override;
+    bool queryMany(const PGE_Rect<int64_t> *zones, int n, t_zoneResultCallback a_resultCallback, void *context) const override;
+    PGE_EditSceneItem *queryPoint(int64_t x, int64_t y) const override;
+    void nearest(int64_t x, int64_t y, int k, int64_t maxDistance, ItemsList *resultList) const override;
+    /**
+     * @brief Search elements crossed by a line segment, in the order the segment enters them
+     * (all of them are collected and sorted before the first callback, even when it stops the search)
+     */
+    bool querySegment(int64_t x1, int64_t y1, int64_t x2, int64_t y2, t_resultCallback a_resultCallback, void *context) const override;
+    using PgeSceneIndex::querySegment;
+
+protected:
+    void clearIndex(const ItemsList &items) override;
+
+private:
+    //! Element with a copy of its bounding rectangle
+    struct Entry
+    {
+        int64_t left;
+        int64_t top;
+        int64_t width;
+        int64_t height;
+        PGE_EditSceneItem *item;
+    };
+    typedef QVector<Entry> Chunk;
+
+    //! Chunks which have at least one element, by chunkKey()
+    QHash<quint64, Chunk> m_chunks;
+    //! Elements which are larger than a chunk
+    Chunk m_oversized;
+    //! Range of chunk coordinates which ever had elements (since the last clearing)
+    int64_t m_minChunkX = 0;
+    int64_t m_minChunkY = 0;
+    int64_t m_maxChunkX = -1;
+    int64_t m_maxChunkY = -1;
+    //! Largest size of the elements kept in chunks (since the last clearing), how far they reach out of their chunk
+    int64_t m_maxWidth = 0;
+    int64_t m_maxHeight = 0;
+    UpdateCounters m_counters;
+
+    static Entry makeEntry(PGE_EditSceneItem *obj);
+    static bool isOversized(const Entry &e);
+    static int64_t chunkCoord(int64_t v);
+    static quint64 chunkKey(int64_t chunkX, int64_t chunkY);
+
+    bool insertOne(PGE_EditSceneItem *obj);
+    bool updateOne(PGE_EditSceneItem *obj);
+    void place(const Entry &e);
+    void unplace(PGE_EditSceneItem *obj);
+    /**
+     * @brief Call visitor(const Entry &) on every entry of the chunks which can have elements intersecting the area
+     * @return false if search was stopped by the visitor
+     */
+    template<class Visitor>
+    bool forEachCandidate(int64_t left, int64_t top, int64_t right, int64_t bottom, Visitor &&visitor) const;
+    //! Same as query(), on the entries
+    template<class Visitor>
+    bool forEachIntersecting(const PGE_Rect<int64_t> &zone, Visitor &&visitor) const;
+};
+
+#endif // PGE_TILE_GRID_H
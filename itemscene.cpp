@@ -1,10 +1,14 @@
 #include "itemscene.h"
 #include "item_scene/pge_edit_scene.h"
+#include "item_scene/pge_quad_tree.h"
+#include "benchmarks.h"
 #include "ui_itemscene.h"
 
 #include <QMdiSubWindow>
 #include <QKeyEvent>
 #include <QDesktopWidget>
+#include <QMessageBox>
+#include <QApplication>
 
 ItemScene::ItemScene(QWidget *parent) :
     QMainWindow(parent),
@@ -59,7 +63,38 @@ void ItemScene::keyPressEvent(QKeyEvent *event)
 
 void ItemScene::on_actionAdd80_triggered()
 {
-    QMdiSubWindow *w = ui->centralWidget->addSubWindow(new PGE_EditScene(ui->centralWidget));
+    add80Entries(PGE_EditScene::IndexLooseQuadTree);
+}
+
+void ItemScene::on_actionAdd1000000_triggered()
+{
+    addMillionEntries(PGE_EditScene::IndexLooseQuadTree);
+}
+
+void ItemScene::on_actionAdd80TileGrid_triggered()
+{
+    add80Entries(PGE_EditScene::IndexTileGrid);
+}
+
+void ItemScene::on_actionAdd1000000TileGrid_triggered()
+{
+    addMillionEntries(PGE_EditScene::IndexTileGrid);
+}
+
+void ItemScene::on_actionAdd80PackedRTree_triggered()
+{
+    add80Entries(PGE_EditScene::IndexPackedRTree);
+}
+
+void ItemScene::on_actionAdd1000000PackedRTree_triggered()
+{
+    addMillionEntries(PGE_EditScene::IndexPackedRTree);
+}
+
+void ItemScene::add80Entries(int index)
+{
+    PGE_EditScene::IndexBackend backend = static_cast<PGE_EditScene::IndexBackend>(index);
+    QMdiSubWindow *w = ui->centralWidget->addSubWindow(new PGE_EditScene(ui->centralWidget, backend));
     w->resize(800, 600);
     PGE_EditScene *e = qobject_cast<PGE_EditScene *>(w->widget());
     bool offset = false;
@@ -69,17 +104,23 @@ void ItemScene::on_actionAdd80_triggered()
             e->addRect(x,  y + (offset ? 16 : 0));
             offset = !offset;
         }
-    w->setWindowTitle(windowTitle() + QString(" (totally items on this map: %1)").arg(e->m_tree.count()));
+    w->setWindowTitle(windowTitle() + QString(" (totally items on this map: %1)").arg(e->m_tree->count()));
     w->show();
     setFocusProxy(w);
 }
 
-void ItemScene::on_actionAdd1000000_triggered()
+void ItemScene::addMillionEntries(int index)
 {
-    QMdiSubWindow *w = ui->centralWidget->addSubWindow(new PGE_EditScene(ui->centralWidget));
+    PGE_EditScene::IndexBackend backend = static_cast<PGE_EditScene::IndexBackend>(index);
+    QMdiSubWindow *w = ui->centralWidget->addSubWindow(new PGE_EditScene(ui->centralWidget, backend));
     w->resize(800, 600);
     PGE_EditScene *e = qobject_cast<PGE_EditScene *>(w->widget());
-    w->setWindowTitle(QString("Million items"));
+    QString title("Million items");
+    if(backend == PGE_EditScene::IndexTileGrid)
+        title += " (tile grid)";
+    else if(backend == PGE_EditScene::IndexPackedRTree)
+        title += " (packed R-tree)";
+    w->setWindowTitle(title);
     w->show();
     e->startInitAsync();
     setFocusProxy(e);
@@ -177,6 +218,64 @@ void ItemScene::on_actionResetZoom_triggered()
 
 
 
+void ItemScene::on_actionIndexNodes_triggered()
+{
+    QMdiSubWindow *w = ui->centralWidget->activeSubWindow();
+    if(w)
+    {
+        PGE_EditScene *e = qobject_cast<PGE_EditScene *>(w->widget());
+        if(e)
+        {
+            e->toggleIndexNodes();
+        }
+    }
+}
+
+void ItemScene::on_actionIndexLod_triggered()
+{
+    QMdiSubWindow *w = ui->centralWidget->activeSubWindow();
+    if(w)
+    {
+        PGE_EditScene *e = qobject_cast<PGE_EditScene *>(w->widget());
+        if(e)
+        {
+            e->toggleLod();
+        }
+    }
+}
+
+void ItemScene::on_actionIndexStats_triggered()
+{
+    QMdiSubWindow *w = ui->centralWidget->activeSubWindow();
+    if(!w)
+        return;
+    PGE_EditScene *e = qobject_cast<PGE_EditScene *>(w->widget());
+    if(!e || e->isBusy())
+        return;
+    const PgeQuadTree *tree = dynamic_cast<const PgeQuadTree *>(e->m_tree.get());
+    if(!tree)
+    {
+        showBenchmarkReport("Tree statistics", "Only the loose quadtree has the statistics of its nodes.");
+        return;
+    }
+
+    PgeQuadTree::Stats s = tree->stats();
+    QString report = QString("%1 items in %2 nodes, %3 items per node on average, %4 at most\n")
+                     .arg(s.items).arg(s.nodes).arg(s.avgItemsPerNode, 0, 'f', 2).arg(s.maxItemsPerNode);
+    report += QString("removed items waiting for the compaction: %1\n").arg(s.removedRecords);
+    report += QString("memory blocks: %1 in use, %2 free\n").arg(s.usedBlocks).arg(s.freeBlocks);
+    report += QString("maximal depth of items: %1\n").arg(s.maximalDepth);
+    report += QString("root node: %1 x %2 at %3 x %4\n")
+              .arg(s.looseBounds.width()).arg(s.looseBounds.height())
+              .arg(s.looseBounds.x()).arg(s.looseBounds.y());
+    for(int depth = 0; depth < s.nodesPerDepth.size(); depth++)
+    {
+        report += QString("depth %1: %2 nodes, %3 items\n")
+                  .arg(depth).arg(s.nodesPerDepth[depth]).arg(s.itemsPerDepth[depth]);
+    }
+    showBenchmarkReport("Tree statistics", report);
+}
+
 void ItemScene::on_listWidget_itemClicked(QListWidgetItem * /*item*/)
 {
     ItemScene *s = qobject_cast<ItemScene *>(ui->dockWidget->parent());
@@ -184,3 +283,61 @@ void ItemScene::on_listWidget_itemClicked(QListWidgetItem * /*item*/)
     s->setFocus(Qt::MouseFocusReason);
     return;
 }
+
+void ItemScene::on_actionBenchBulkInsert_triggered()
+{
+    runBenchmark("Bulk insert", SceneBenchmarks::bulkInsert);
+}
+
+void ItemScene::on_actionBenchViewportQuery_triggered()
+{
+    runBenchmark("Viewport query", SceneBenchmarks::viewportQuery);
+}
+
+void ItemScene::on_actionBenchNearestQuery_triggered()
+{
+    runBenchmark("Nearest elements query", SceneBenchmarks::nearestQuery);
+}
+
+void ItemScene::on_actionBenchIndexBackends_triggered()
+{
+    runBenchmark("Index backends", SceneBenchmarks::indexBackends);
+}
+
+void ItemScene::on_actionBenchViewportScaling_triggered()
+{
+    runBenchmark("Viewport query scaling", SceneBenchmarks::viewportScaling);
+}
+
+void ItemScene::on_actionBenchBlocksAllocator_triggered()
+{
+    runBenchmark("Blocks allocator", SceneBenchmarks::blocksAllocator);
+}
+
+void ItemScene::on_actionBenchNodeScan_triggered()
+{
+    runBenchmark("Node scan kernels", SceneBenchmarks::nodeScan);
+}
+
+void ItemScene::on_actionBenchRemovalQueries_triggered()
+{
+    runBenchmark("Queries after removals", SceneBenchmarks::removalQueries);
+}
+
+void ItemScene::on_actionBenchAreaCount_triggered()
+{
+    runBenchmark("Area count and bounds", SceneBenchmarks::areaCount);
+}
+
+void ItemScene::runBenchmark(const QString &title, QString (*benchmark)())
+{
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    QString report = benchmark();
+    QApplication::restoreOverrideCursor();
+    showBenchmarkReport(title, report);
+}
+
+void ItemScene::showBenchmarkReport(const QString &title, const QString &report)
+{
+    QMessageBox::information(this, title, report);
+}
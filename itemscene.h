@@ -22,6 +22,10 @@ public:
 private slots:
     void on_actionAdd80_triggered();
     void on_actionAdd1000000_triggered();
+    void on_actionAdd80TileGrid_triggered();
+    void on_actionAdd1000000TileGrid_triggered();
+    void on_actionAdd80PackedRTree_triggered();
+    void on_actionAdd1000000PackedRTree_triggered();
     void on_actionPoke_triggered();
     void on_actionMoveto0x0_triggered();
     void on_actionMoveToM100xM100_triggered();
@@ -29,10 +33,40 @@ private slots:
     void on_actionZoomIn_triggered();
     void on_actionZoomOut_triggered();
     void on_actionResetZoom_triggered();
+    void on_actionIndexNodes_triggered();
+    void on_actionIndexStats_triggered();
+    void on_actionIndexLod_triggered();
 
     void on_listWidget_itemClicked(QListWidgetItem *item);
 
+    void on_actionBenchBulkInsert_triggered();
+    void on_actionBenchViewportQuery_triggered();
+    void on_actionBenchNearestQuery_triggered();
+    void on_actionBenchIndexBackends_triggered();
+    void on_actionBenchViewportScaling_triggered();
+    void on_actionBenchBlocksAllocator_triggered();
+    void on_actionBenchNodeScan_triggered();
+    void on_actionBenchRemovalQueries_triggered();
+    void on_actionBenchAreaCount_triggered();
+
 private:
+    /**
+     * @brief Open a scene window with 80 entries
+     * @param index Kind of the spatial index (PGE_EditScene::IndexBackend)
+     */
+    void add80Entries(int index);
+    /**
+     * @brief Open a scene window and start loading a million entries into it
+     * @param index Kind of the spatial index (PGE_EditScene::IndexBackend)
+     */
+    void addMillionEntries(int index);
+    /**
+     * @brief Run a benchmark under the wait cursor and show its report
+     * @param title Title of the report window
+     * @param benchmark One of the SceneBenchmarks functions
+     */
+    void runBenchmark(const QString &title, QString (*benchmark)());
+    void showBenchmarkReport(const QString &title, const QString &report);
     Ui::ItemScene *ui;
 };
 